@@ -2,68 +2,262 @@
 #include <Eigen/Core>
 #include <memory>
 #include "particle.hpp"
+#include "trace.hpp"
+#include "allocation.hpp"
+#include "perfcounter.hpp"
+#include "views.hpp"
+#include "jobfile.hpp"
+#include "ensemble.hpp"
+#include "isa.hpp"
 #include <CLI11.hpp>
 #include <vector>
 #include <tuple>
 #include <string>
+#include <atomic>
+#include <cstdio>
+#include <iomanip>
+#include <fcntl.h>
+#include <unistd.h>
 
-int main(int argc, char** argv) {
-
-  // set up parser
-  CLI::App app{"Solar System Simulator"};
+// the initial conditions of a run, with its integrator, force law and reordering
+static std::unique_ptr<pSystem> makeSystem(const RunConfig& c) {
+  std::unique_ptr<pSystem> s1;
+  if(c.nbody>0)
+  {
+    s1 = randomSysGenerator(c.nbody, c.seed).generateInitialConditions();
+  }else if(!c.initial.empty()){
+    s1 = fileSysGenerator(c.initial).generateInitialConditions();
+  }else{
+    s1 = solarSysGenerator(c.seed).generateInitialConditions();
+  }
+  if(c.reorder == "morton"){
+    s1->setReordering(SpaceCurve::morton, c.reorderInterval);
+  }else if(c.reorder == "hilbert"){
+    s1->setReordering(SpaceCurve::hilbert, c.reorderInterval);
+  }
+  if(c.integrator == "leapfrog"){
+    s1->setIntegrator(Integrator::leapfrog);
+  }
+  if(c.forceLaw == "spline"){
+    s1->setForceLaw(ForceLaw::spline);
+  }else if(c.forceLaw == "truncated"){
+    s1->setForceLaw(ForceLaw::truncated, c.cutoff);
+  }
+  return s1;
+}
 
-  // these will throw exceptions if not initialized
-  double dt = 0.0;
-  double t = 0.0;
-  double epsilon = 0.0;
-  int n = 0;
+// instruction set the kernels run at, and the widest one the cpu has
+static std::string describeVectorIsa() {
+  std::string text = isaName(activeVectorIsa());
+  if(activeVectorIsa() != detectVectorIsa()){
+    text += " (cpu supports " + std::string(isaName(detectVectorIsa())) + ", lowered by NBODY_ISA)";
+  }
+  return text;
+}
 
-  // build parser
-  app.add_option("-t, --time", t, "Total simulation time.");
-  app.add_option("-s, --timestep", dt, "Time step for Euler integration.");
-  app.add_option("-e, --epsilon", epsilon, "Softening factor for acceleration calculation.");
-  app.add_option("-n, --nbody", n, "Specifies the number of bodies to simulate, if not set, the system is a randomly positioned solar system.");
+// sets up, evolves and reports one run; c has been validated
+static void runSimulation(const RunConfig& c, bool printConfig) {
 
-  // throw exception by the parser if input format is invalid
-  // otherwise parse input
-  try{
-    app.parse(argc, argv);
-  } catch(const CLI::ParseError &e){
-    return app.exit(e);
+  // the page policy applies to blocks allocated from now on, so it has to be set before the systems are built
+  if(c.hugePages == "transparent"){
+    setHugePages(HugePages::transparent);
+  }else if(c.hugePages == "reserved"){
+    setHugePages(HugePages::reserved);
+  }else{
+    setHugePages(HugePages::off);
   }
 
-  if(argc == 0 || dt<=0 || t<=0 || epsilon<0 || n < 0){
-    std::cout << "No argument given, or arguments are wrong." << std::endl;
-    std::cerr << app.help() << std::flush;
-    return 0;
+  // tracing is opt-in, it has to be enabled before the system is evolved
+  if(!c.trace.empty() || !c.profile.empty()){
+    Tracer::clear();
+    Tracer::enable();
   }
-  
-  // create system generator
-  // random seed values can be set in the constructor of randomSysGenerator and solarSysGenerator classes
-  randomSysGenerator randomGenerator = randomSysGenerator(n);
-  solarSysGenerator solarGenerator = solarSysGenerator();
 
-  // create timer
-  Timer timer;
+  // setup covers building the system and planning, which may calibrate; the runtime covers the evolution only
+  Timer setupTimer;
 
   // initialize system based one which type of simulation is ran
-  std::unique_ptr<pSystem> s1;
-  if(n>0)
-  {
-    s1 = randomGenerator.generateInitialConditions();
+  std::unique_ptr<pSystem> s1 = makeSystem(c);
+
+  // pick serial/parallel execution and thread count for this system size, user options override the model
+  ExecutionPlanner planner;
+  if(c.threads > 0){
+    planner.setThreads(c.threads);
+  }
+  if(c.smt){
+    planner.setSMT(true);
+  }
+  if(c.pin == "compact"){
+    planner.setPinning(ThreadPinning::compact);
+  }else if(c.pin == "scatter"){
+    planner.setPinning(ThreadPinning::scatter);
+  }
+  planner.setFirstTouch(c.firstTouch);
+  if(c.decomposition == "rows"){
+    planner.setDecomposition(ForceDecomposition::rows);
+  }else if(c.decomposition == "blocks"){
+    planner.setDecomposition(ForceDecomposition::blocks);
+  }
+  planner.setTileSize(c.tileSize);
+  planner.setDeterministic(c.deterministic);
+  planner.setFixedSize(c.fixedSize);
+  if(c.backend == "pool" || (c.backend.empty() && !openMPAvailable())){
+    planner.setBackend(Backend::pool);
+  }else if(c.backend == "serial"){
+    planner.setBackend(Backend::serial);
   }else{
-    s1 = solarGenerator.generateInitialConditions();
+    planner.setBackend(Backend::openmp);
+  }
+  s1->setExecutionPlan(planner.plan(s1->getNumOfParticles()));
+  std::cout << "Execution plan: " << s1->getExecutionPlan().describe() << std::endl;
+  const std::string vectorIsa = describeVectorIsa() + (s1->usesFixedSize() ? ", fixed-size engine" : ", generic loops");
+
+  OutputOptions output;
+  output.precision = c.precision;
+  if(c.format == "csv"){
+    output.format = OutputFormat::csv;
+  }else if(c.format == "tsv"){
+    output.format = OutputFormat::tsv;
+  }
+
+  if(printConfig){
+    std::cout << "system: ";
+    if(c.nbody > 0){
+      std::cout << c.nbody << " random bodies" << std::endl;
+    }else if(!c.initial.empty()){
+      std::cout << s1->getNumOfParticles() << " bodies from " << c.initial;
+      if(s1->getStepCount() > 0){
+        std::cout << ", continuing from step " << s1->getStepCount() << " (t=" << s1->getTime() << ")";
+      }
+      std::cout << std::endl;
+    }else{
+      std::cout << "solar system" << std::endl;
+    }
+    std::cout << "seed: " << c.seed << std::endl;
+    std::cout << "time: " << c.time << ", time step: " << c.timestep << ", epsilon: " << c.epsilon << std::endl;
+    std::cout << "integrator: " << c.integrator << std::endl;
+    std::cout << "force law: " << c.forceLaw;
+    if(c.forceLaw == "truncated"){
+      std::cout << ", cutoff " << c.cutoff;
+    }
+    std::cout << std::endl;
+    std::cout << "plan: " << s1->getExecutionPlan().describe() << std::endl;
+    std::cout << "backend: " << s1->getBackendName() << std::endl;
+    std::cout << "vector kernels: " << vectorIsa << std::endl;
+    std::cout << "reordering: " << c.reorder;
+    if(c.reorder != "none"){
+      std::cout << ", first check after " << c.reorderInterval << " steps";
+    }
+    std::cout << std::endl;
+    std::cout << "huge pages: " << c.hugePages << std::endl;
+    std::cout << "output: " << c.format << ", " << c.precision << " digits, " << (c.quiet ? "summary only" : "before and after");
+    if(c.outputEvery > 0){
+      std::cout << " and every " << c.outputEvery << " steps";
+    }
+    std::cout << std::endl;
+    std::cout << "checkpoints: ";
+    if(c.checkpointEvery > 0){
+      std::cout << "every " << c.checkpointEvery << " steps to " << c.checkpoint << std::endl;
+    }else{
+      std::cout << "off" << std::endl;
+    }
+    std::cout << "escapers: " << (c.escapers > 0 ? "every " + std::to_string(c.escapers) + " steps" : std::string("off")) << std::endl;
+    std::cout << "trace: " << (c.trace.empty() ? std::string("off") : c.trace) << ", profile: "
+              << (c.profile.empty() ? std::string("off") : c.profile) << std::endl;
+    std::cout << "allocation tracking: " << (AllocationTracker::hooked() ? "on" : "off") << std::endl;
+    Tracer::disable();
+    return;
+  }
+
+  // periodic output and checkpoints are inlined observers, they see the particles between two steps
+  if(c.outputEvery > 0){
+    s1->addObserver("output", c.outputEvery, [&](const StepState& state){
+      std::cout << "State at step " << state.step << " (t=" << state.time << "):" << std::endl;
+      s1->printParticles(output);
+    });
+  }
+  if(c.checkpointEvery > 0){
+    // written next to the old checkpoint and renamed over it, so there is always a complete one
+    // the comment line in front of the particles lets --initial continue the step count and time
+    s1->addObserver("checkpoint", c.checkpointEvery, [&](const StepState& state){
+      OutputOptions exact;
+      exact.format = OutputFormat::csv;
+      exact.precision = 17;
+      char clock[64];
+      int length = std::snprintf(clock, sizeof(clock), "# step %ld time %.17g\n", state.step, state.time);
+      std::string partial = c.checkpoint + ".tmp";
+      int fd = ::open(partial.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      bool written = fd >= 0;
+      if(written){
+        try{
+          written = ::write(fd, clock, length) == length;
+          s1->writeParticles(fd, exact);
+        } catch(const std::runtime_error&){
+          written = false;
+        }
+        written = ::close(fd) == 0 && written;
+      }
+      if(!written || std::rename(partial.c_str(), c.checkpoint.c_str()) != 0){
+        std::cerr << "Could not write checkpoint " << c.checkpoint << std::endl;
+      }
+    });
+  }
+
+  // in-situ analysis: bodies with positive energy relative to the centre of mass are escaping the system
+  // it runs on a copy of the state, so the count is kept for the summary rather than printed mid-run
+  std::atomic<long> lastEscapers{0};
+  std::atomic<long> lastEscapersStep{0};
+  if(c.escapers > 0){
+    s1->addObserver("escapers", c.escapers, [&](const StepState& state){
+      ScalarsView masses = asScalars(state.masses);
+      VectorsView positions = asVectors(state.positions);
+      VectorsView velocities = asVectors(state.velocities);
+      double total = masses.sum();
+      Eigen::Vector3d centre = positions*masses/total;
+      Eigen::Vector3d drift = velocities*masses/total;
+      long escapers = 0;
+      for(Eigen::Index i=0; i<masses.size(); i++){
+        double r = (positions.col(i) - centre).norm();
+        double v2 = (velocities.col(i) - drift).squaredNorm();
+        if(r > 0 && 0.5*v2 > total/r){
+          escapers++;
+        }
+      }
+      lastEscapers = escapers;
+      lastEscapersStep = state.step;
+    }, ObserverMode::async);
   }
 
   // save initial energy
   std::tuple<double, double> E = s1->getEnergy();
 
   // print initial state
-  std::cout << "Initial state of the system: " << std::endl;
-  s1->printParticles();
+  if(!c.quiet){
+    std::cout << "Initial state of the system: " << std::endl;
+    s1->printParticles(output);
+  }
+
+  // count heap allocations during the evolution, only when built with NBODY_TRACK_ALLOCATIONS
+  if(AllocationTracker::hooked()){
+    AllocationTracker::reset();
+    AllocationTracker::enable();
+  }
+
+  // dTLB misses of every thread; the workers of the force loops exist by now, getEnergy and the plan started them
+  PerfCounter tlbLoads(PerfCounter::Event::dtlbLoads, PerfCounter::Scope::process);
+  PerfCounter tlbMisses(PerfCounter::Event::dtlbLoadMisses, PerfCounter::Scope::process);
+  tlbLoads.start();
+  tlbMisses.start();
+  const double setup = setupTimer.elapsed();
+  const long stepsBefore = s1->getStepCount();
+  Timer timer;
 
   // evolve the system with total time t and time step dt and epsilon=0.0
-  s1->evolveSystem(t, dt, epsilon);
+  s1->evolveSystem(c.time, c.timestep, c.epsilon);
+  s1->waitForObservers();
+  AllocationTracker::disable();
+  tlbMisses.stop();
+  tlbLoads.stop();
 
   // measure elapsed time
   double elapsed = timer.elapsed();
@@ -77,11 +271,261 @@ int main(int argc, char** argv) {
   // print final state
   std::cout << std::endl;
   std::cout << "Simulation done: " << std::endl;
-  std::cout << "Particle positions and velocity after the simulation:" << std::endl;
-  s1->printParticles();
+  if(!c.quiet){
+    std::cout << "Particle positions and velocity after the simulation:" << std::endl;
+    s1->printParticles(output);
+  }
   std::cout << "Simulation summary: " << std::endl;
-  std::cout << "n: " << n << " t: " << t << " dt: " << dt << " runtime: " << elapsed << "s  /step: " << elapsed/int(t/dt) << "s" << std::endl;
+  std::cout << "n: " << c.nbody << " t: " << c.time << " dt: " << c.timestep << " runtime: " << elapsed << "s  /step: "
+            << elapsed/std::max(1L, s1->getStepCount() - stepsBefore) << "s" << std::endl;
+  std::cout << "setup (initial conditions and planning): " << setup << "s" << std::endl;
   std::cout << "%E change during the simulation: " << percentChangeE <<  std::endl;
+  std::cout << "vector kernels: " << vectorIsa << std::endl;
+  auto poolExecutor = std::dynamic_pointer_cast<PoolExecutor>(s1->getExecutor());
+  if(poolExecutor){
+    WorkStealingPool::Stats stats = poolExecutor->getPool()->stats();
+    std::cout << "work stealing: " << poolExecutor->getPool()->numThreads() << " threads, " << stats.chunks << " chunks, "
+              << stats.steals << " steals, " << stats.failedSteals << " failed steals, "
+              << stats.idleSeconds << "s idle" << std::endl;
+  }
+  // bytes each thread's scratch arena handed out since its last reset, and the most between two resets
+  std::vector<ArenaGroup::Stats> arenas = s1->getScratch().arenaStats();
+  std::cout << "scratch arenas:";
+  for(std::size_t i=0; i<arenas.size(); i++){
+    std::cout << " [" << i << "] " << arenas[i].bytesUsed << "B in use, peak " << arenas[i].peakBytes << "B";
+  }
+  std::cout << std::endl;
+  if(AllocationTracker::hooked()){
+    AllocationTracker::report(std::cout);
+  }
+  if(c.hugePages != "off"){
+    HugePageStats pages = hugePageStats();
+    std::cout << "huge pages: " << pages.reservedBytes/1048576.0 << " MB reserved, " << pages.transparentBytes/1048576.0
+              << " MB advised transparent, " << pages.fallbacks << " fallbacks, " << residentHugePageBytes()/1048576.0
+              << " MB resident in huge pages" << std::endl;
+  }
+  if(tlbMisses.available() && tlbLoads.available()){
+    std::cout << "dTLB (" << tlbMisses.threads() << " threads, huge pages " << c.hugePages << "): " << tlbMisses.read() << " load misses, "
+              << 1000.0*tlbMisses.read()/std::max<std::uint64_t>(1, tlbLoads.read()) << " per 1000 loads" << std::endl;
+  }else{
+    std::cout << "dTLB counters not available" << std::endl;
+  }
+  if(c.reorder != "none"){
+    const ReorderStats& stats = s1->getReorderStats();
+    std::cout << "reordering: " << stats.reorders << " sorts in " << stats.checks << " checks, final interval "
+              << stats.interval << " steps, last disorder " << stats.disorder << std::endl;
+  }
+
+  for(const ObserverStats& stats : s1->getObserverStats()){
+    std::cout << "observer " << stats.name << ": " << stats.calls << " calls every " << stats.every << " steps, "
+              << stats.observerSeconds << "s observing, " << stats.stepSeconds << "s ("
+              << 100.0*stats.stepSeconds/elapsed << "%) added to the step loop";
+    if(stats.errors > 0){
+      std::cout << ", " << stats.errors << " errors";
+    }
+    std::cout << std::endl;
+  }
+  if(c.escapers > 0){
+    std::cout << "escapers: " << lastEscapers << " unbound bodies at step " << lastEscapersStep << std::endl;
+  }
+
+  Tracer::disable();
+  if(!c.profile.empty()){
+    if(Tracer::writeProfile(c.profile)){
+      std::cout << "profile: written to " << c.profile << std::endl;
+    }else{
+      std::cerr << "Could not write profile file " << c.profile << std::endl;
+    }
+  }
+
+  // dump the timeline at exit, it can be opened in about:tracing or ui.perfetto.dev
+  if(!c.trace.empty()){
+    if(Tracer::writeJSON(c.trace)){
+      std::cout << "trace: " << Tracer::numEvents() << " events written to " << c.trace
+                << " (" << Tracer::numDropped() << " dropped)" << std::endl;
+    }else{
+      std::cerr << "Could not write trace file " << c.trace << std::endl;
+    }
+  }
+}
+
+// runs every run members times at once, with consecutive seeds, and reports the throughput
+static void runEnsemble(const std::vector<RunConfig>& runs, int members, int workers, bool batch) {
+  Ensemble ensemble(workers);
+  ensemble.setBatching(batch);
+  for(const RunConfig& run : runs){
+    for(int k=0; k<members; k++){
+      RunConfig member = run;
+      member.seed = run.seed + k;
+      std::string name = members > 1 ? run.name + " seed " + std::to_string(member.seed) : run.name;
+      ensemble.add(Ensemble::Member{name, [member]{
+        std::unique_ptr<pSystem> s1 = makeSystem(member);
+        ExecutionPlan plan;
+        plan.deterministic = member.deterministic;
+        plan.fixedSize = member.fixedSize;
+        plan.tileSize = member.tileSize;
+        s1->setExecutionPlan(plan);
+        return s1;
+      }, member.time, member.timestep, member.epsilon});
+    }
+  }
+
+  const std::string vectorIsa = describeVectorIsa();
+  std::vector<Ensemble::Result> results = ensemble.run();
+  const Ensemble::Stats& stats = ensemble.stats();
+  std::cout << "Ensemble of " << ensemble.size() << " systems on " << stats.workers << " workers, vector kernels "
+            << vectorIsa << ":" << std::endl;
+  std::cout << std::left << std::setw(32) << "system" << std::right << std::setw(10) << "n" << std::setw(10) << "steps"
+            << std::setw(14) << "runtime (s)" << std::setw(16) << "%E change" << std::endl;
+  int failed = 0;
+  for(const Ensemble::Result& result : results){
+    std::cout << std::left << std::setw(32) << result.name << std::right;
+    if(!result.error.empty()){
+      std::cout << "  failed: " << result.error << std::endl;
+      failed++;
+      continue;
+    }
+    std::cout << std::setw(10) << result.bodies << std::setw(10) << result.steps << std::setw(14) << result.seconds
+              << std::setw(16) << result.energyChange << std::endl;
+  }
+  std::cout << "Ensemble summary: " << stats.systemSteps << " system-steps in " << stats.wallSeconds << "s, "
+            << stats.systemStepsPerSecond << " system-steps/s, "
+            << 100.0*stats.busySeconds/std::max(1e-9, stats.workers*stats.wallSeconds) << "% of the workers busy";
+  if(failed > 0){
+    std::cout << ", " << failed << " systems failed";
+  }
+  std::cout << std::endl;
+}
+
+int main(int argc, char** argv) {
+
+  // set up parser
+  CLI::App app{"Solar System Simulator"};
+
+  // time and timestep have no defaults, a run without them is rejected below
+  RunConfig config;
+  std::string jobFile;
+  bool printConfig = false;
+  int ensembleMembers = 0;
+  int workers = 0;
+  bool batch = false;
+
+  // build parser
+  app.add_option("-t, --time", config.time, "Total simulation time.");
+  app.add_option("-s, --timestep", config.timestep, "Time step of the integrator.");
+  app.add_option("-e, --epsilon", config.epsilon, "Softening factor for acceleration calculation.");
+  app.add_option("--force-law", config.forceLaw, "Softening of the pair force: plummer, spline (Newtonian beyond epsilon) or truncated (zero beyond --cutoff).")
+      ->check(CLI::IsMember({"plummer", "spline", "truncated"}));
+  app.add_option("--cutoff", config.cutoff, "Radius beyond which the truncated force law is zero.");
+  app.add_option("-n, --nbody", config.nbody, "Specifies the number of bodies to simulate, if not set, the system is a randomly positioned solar system.");
+  app.add_option("--seed", config.seed, "Seed of the random bodies, or of the starting angles of the planets.");
+  app.add_option("--initial", config.initial, "Start from the particles in this CSV file, e.g. a checkpoint or a --format csv dump.");
+  app.add_option("--integrator", config.integrator, "Time integration scheme: euler (first order) or leapfrog (second order, symplectic).")
+      ->check(CLI::IsMember({"euler", "leapfrog"}));
+  app.add_option("-j, --threads", config.threads, "Number of threads, 1 runs serially. If not set, the planner picks serial or parallel execution and the thread count from the system size.");
+  app.add_flag("--smt", config.smt, "Allow the planner to use SMT (hyper-threading) siblings.");
+  app.add_option("--pin", config.pin, "Pin threads to cpus: none, compact (fill one socket first) or scatter (round-robin over sockets).")
+      ->check(CLI::IsMember({"none", "compact", "scatter"}));
+  app.add_flag("--first-touch", config.firstTouch, "Place the particle arrays in parallel with the partition of the force loop, so every NUMA node owns its slice.");
+  app.add_option("--decomposition", config.decomposition, "Split the force loop into rows or 2D (i-tile, j-tile) blocks, auto lets the planner choose.")
+      ->check(CLI::IsMember({"auto", "rows", "blocks"}));
+  app.add_option("--tile-size", config.tileSize, "Side length of the 2D force blocks, 0 picks one from the thread count.");
+  app.add_flag("--deterministic", config.deterministic, "Make results bitwise identical whatever the thread count, backend or decomposition.");
+  app.add_flag("--fixed-size,!--no-fixed-size", config.fixedSize, "Step serial runs of up to 16 bodies in an engine compiled for their size (default on).");
+  app.add_option("--backend", config.backend, "What runs the parallel loops: openmp, pool (in-tree work-stealing thread pool) or serial. Defaults to openmp if it is available.")
+      ->check(CLI::IsMember({"openmp", "pool", "serial"}));
+  app.add_option("--reorder", config.reorder, "Keep the particles sorted along a space-filling curve: none, morton or hilbert.")
+      ->check(CLI::IsMember({"none", "morton", "hilbert"}));
+  app.add_option("--reorder-interval", config.reorderInterval, "Steps between the first checks of the particle ordering, adapted during the run.");
+  app.add_option("--huge-pages", config.hugePages, "Back large particle and scratch arrays with 2 MB pages: off, transparent (madvise) or reserved (MAP_HUGETLB, falls back to transparent).")
+      ->check(CLI::IsMember({"off", "transparent", "reserved"}));
+  app.add_option("--format", config.format, "Format of the particle dumps: text, csv or tsv.")
+      ->check(CLI::IsMember({"text", "csv", "tsv"}));
+  app.add_option("--precision", config.precision, "Significant digits of the numbers in the particle dumps, 1 to 17.")
+      ->check(CLI::Range(1, 17));
+  app.add_flag("-q, --quiet", config.quiet, "Only print the summary, not the particles before and after the simulation.");
+  app.add_option("--output-every", config.outputEvery, "Also print the particles every K steps during the simulation.");
+  app.add_option("--checkpoint-every", config.checkpointEvery, "Write a checkpoint of the particles every K steps.");
+  app.add_option("--checkpoint", config.checkpoint, "File the checkpoints are written to, as CSV with full precision (default checkpoint.csv).");
+  app.add_option("--escapers", config.escapers, "Count the bodies not bound to the system every K steps, in the background while the system steps on.");
+  app.add_option("--trace", config.trace, "Record a per-thread timeline and write it to this file in Chrome trace-event JSON format.");
+  app.add_option("--profile", config.profile, "Write the time spent in every phase of the step loop to this file as CSV.");
+  app.add_option("--job", jobFile, "Run the runs described in this job file; options given on the command line are the defaults of every run.");
+  app.add_option("--ensemble", ensembleMembers, "Run every run this many times at once with consecutive seeds, one system per worker, and report the throughput.");
+  app.add_option("--workers", workers, "Worker threads of the ensemble, 0 uses one per physical core.");
+  app.add_flag("--batch", batch, "Step ensemble members of the same size, time, timestep, epsilon and integrator together, several systems per SIMD instruction.");
+  app.add_flag("--print-config", printConfig, "Print the configuration and execution plan the options resolve to, and exit without simulating.");
+
+  // throw exception by the parser if input format is invalid
+  // otherwise parse input
+  try{
+    app.parse(argc, argv);
+  } catch(const CLI::ParseError &e){
+    return app.exit(e);
+  }
+
+  // everything is checked before the first run starts, so a bad run in a job fails straight away
+  std::vector<RunConfig> runs;
+  if(jobFile.empty()){
+    if(config.nbody > 0){
+      config.name = std::to_string(config.nbody) + " bodies";
+    }else{
+      config.name = config.initial.empty() ? "solar system" : config.initial;
+    }
+    runs.push_back(config);
+  }else{
+    try{
+      runs = readJobFile(jobFile, config);
+    } catch(const JobError& e){
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  }
+  std::vector<std::string> problems = validateJobs(runs);
+  if(ensembleMembers > 0){
+    for(const std::string& problem : validateEnsemble(runs)){
+      problems.push_back(problem);
+    }
+  }
+  if(ensembleMembers < 0 || workers < 0){
+    problems.push_back("ensemble and workers must be >= 0");
+  }
+  if(batch && ensembleMembers == 0){
+    problems.push_back("batch only applies to an ensemble");
+  }
+  if(!problems.empty()){
+    if(jobFile.empty()){
+      std::cout << "No argument given, or arguments are wrong." << std::endl;
+      for(const std::string& problem : problems){
+        std::cerr << problem << std::endl;
+      }
+      std::cerr << app.help() << std::flush;
+      return 0;
+    }
+    for(const std::string& problem : problems){
+      std::cerr << problem << std::endl;
+    }
+    std::cerr << problems.size() << " problems in " << jobFile << ", nothing was run" << std::endl;
+    return 1;
+  }
+
+  if(ensembleMembers > 0 && !printConfig){
+    runEnsemble(runs, ensembleMembers, workers, batch);
+    return 0;
+  }
+
+  for(std::size_t i=0; i<runs.size(); i++){
+    if(!jobFile.empty()){
+      std::cout << (i == 0 ? "" : "\n") << "Run " << i + 1 << " of " << runs.size() << ": " << runs[i].name
+                << " (" << runs[i].source << ")" << std::endl;
+    }
+    try{
+      runSimulation(runs[i], printConfig);
+    } catch(const std::exception& e){
+      std::cerr << runs[i].name << " failed: " << e.what() << std::endl;
+      return 1;
+    }
+  }
 
   return 0;
 }
@@ -0,0 +1,54 @@
+#ifndef allocation_h
+#define allocation_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// counts heap allocations made through the global operator new, per phase of the step loop
+// the counting needs the operator new replacement in alloc_hook.cpp, which is linked into the tests
+// and, with the NBODY_TRACK_ALLOCATIONS CMake option, into the simulator; without it nothing is counted
+// phases are the names of the TraceScopes the allocating thread is inside of
+class AllocationTracker {
+    public:
+        struct Phase {
+            const char* name;
+            std::uint64_t allocations;
+            std::uint64_t bytes;
+        };
+
+        // true if the operator new replacement is linked in
+        static bool hooked();
+
+        static void enable();
+        static void disable();
+        static bool enabled() { return active.load(std::memory_order_relaxed); }
+
+        // forget everything counted so far
+        static void reset();
+        static std::uint64_t numAllocations();
+        static std::uint64_t numBytes();
+        // phases that allocated, in order of their first allocation; this allocates itself, so call it
+        // after disable()
+        static std::vector<Phase> phases();
+
+        // steps run while tracking, to turn the counts into per-step rates
+        static void countSteps(long steps);
+        static std::uint64_t numSteps();
+        static void report(std::ostream& out);
+
+        // called by the hook for every allocation, must not allocate
+        static void record(std::size_t bytes);
+        static void install();
+
+        // phase of the calling thread, enterPhase returns the one it replaces
+        static const char* enterPhase(const char* name);
+        static void leavePhase(const char* previous);
+
+    private:
+        static std::atomic<bool> active;
+};
+
+#endif
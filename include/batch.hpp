@@ -0,0 +1,68 @@
+#ifndef batch_h
+#define batch_h
+
+#include <Eigen/Core>
+#include <cstddef>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "particle.hpp"
+
+// systems that share one SIMD register, 8 doubles fill an AVX-512 register and two AVX or four SSE ones
+const std::size_t batchLanes = 8;
+
+// many small systems with the same number of bodies, stepped side by side. The systems are stored in groups
+// of batchLanes, and inside a group every value of a body sits next to the same value of the same body of
+// the other systems, so each operation of the force and update loops works on batchLanes systems at once
+// and no branch depends on the data (but those of a spline or truncated force law, which are masked). Groups never interact: they are shared out between the threads whole
+// and run all their steps without a barrier.
+// The kernels are compiled for every instruction set level of isa.hpp and run at the active one.
+// Integrators, force laws and step counts are those of pSystem, the results agree with a pSystem to
+// rounding and not bit for bit
+class SystemBatch {
+    public:
+        explicit SystemBatch(std::size_t in_bodies);
+
+        // copies the live particles of system in, there must be bodies() of them; returns its index in the batch
+        std::size_t add(pSystem& system);
+        std::size_t size() const;
+        std::size_t bodies() const;
+
+        void setIntegrator(Integrator in_integrator);
+        Integrator getIntegrator() const;
+        // as pSystem::setForceLaw
+        void setForceLaw(ForceLaw in_forceLaw, double in_cutoff = 0.0);
+        // threads the groups are shared out between, 0 leaves it to OpenMP
+        void setThreads(int in_threads);
+
+        // evolves every system over the steps evolveSystem would take
+        void evolve(double t, double dt, double epsilon = 0.0);
+        long getStepCount() const;
+
+        double getMass(std::size_t system, std::size_t body) const;
+        Eigen::Vector3d getPosition(std::size_t system, std::size_t body) const;
+        Eigen::Vector3d getVelocity(std::size_t system, std::size_t body) const;
+        // kinetic and potential energy of every system, in the order they were added
+        std::vector<std::tuple<double, double>> getEnergies() const;
+        // a pSystem with the current state of one system
+        std::unique_ptr<pSystem> extract(std::size_t system) const;
+
+    private:
+        // the batchLanes values of one field of one body in a group, see batch.cpp for the fields
+        double* lanes(std::size_t group, int field, std::size_t body);
+        const double* lanes(std::size_t group, int field, std::size_t body) const;
+        double value(std::size_t system, int field, std::size_t body) const;
+
+        std::size_t n;
+        std::size_t count = 0;
+        Integrator integrator = Integrator::euler;
+        ForceLaw forceLaw = ForceLaw::plummer;
+        double cutoff = 0.0;
+        int threads = 0;
+        long stepCount = 0;
+        // group after group: field after field, body after body, batchLanes systems
+        std::vector<double> data;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef ensemble_h
+#define ensemble_h
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "particle.hpp"
+
+// runs many independent systems from one process, each system serially on one worker of a
+// work-stealing pool: a sweep of small systems that can not keep more than one core busy each still
+// fills the machine. The systems are built up front and started largest first (n^2 times steps), so a
+// long member does not end up alone at the end of the run
+class Ensemble {
+    public:
+        struct Member {
+            std::string name;
+            // builds the system with its initial conditions, integrator and reordering; the ensemble sets
+            // a serial execution plan, keeping only the deterministic, tile size and fixed-size settings of the system's own
+            std::function<std::unique_ptr<pSystem>()> make;
+            double time;
+            double timestep;
+            double epsilon;
+        };
+
+        struct Result {
+            std::string name;
+            std::size_t bodies = 0;
+            long steps = 0;
+            double seconds = 0.0;
+            // relative change of the total energy over the run, in percent
+            double energyChange = 0.0;
+            // what the member threw, empty if it ran; the other members are not affected
+            std::string error;
+        };
+
+        struct Stats {
+            int workers = 0;
+            long systemSteps = 0;
+            double wallSeconds = 0.0;
+            // summed run time of the members, busySeconds/(workers*wallSeconds) is the utilisation
+            double busySeconds = 0.0;
+            double systemStepsPerSecond = 0.0;
+        };
+
+        // 0 workers uses one per physical core
+        explicit Ensemble(int workers = 0);
+
+        void add(Member member);
+        std::size_t size() const;
+        // step members with the same number of bodies, time, timestep, epsilon, integrator and force law together in
+        // SystemBatches of up to batchLanes systems, one batch per task; their results agree with a
+        // pSystem run to rounding, and each member reports its share of the batch's run time
+        void setBatching(bool in_batching);
+
+        // runs all members and returns their results in the order they were added
+        std::vector<Result> run();
+        // of the last run
+        const Stats& stats() const;
+
+    private:
+        int workers;
+        bool batching = false;
+        std::vector<Member> members;
+        Stats lastStats;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef executor_h
+#define executor_h
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+#include "workstealing.hpp"
+
+// non-owning reference to a callable taking (begin, end), cheap to copy and never allocates
+// the callable must outlive the call it is passed to
+class RangeFunction {
+    public:
+        template<class F, class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, RangeFunction>::value>::type>
+        RangeFunction(F&& f) : context{const_cast<void*>(static_cast<const void*>(&f))}, call{[](void* c, std::size_t b, std::size_t e){
+            (*static_cast<typename std::remove_reference<F>::type*>(c))(b, e);
+        }} {}
+
+        void operator()(std::size_t begin, std::size_t end) const{
+            call(context, begin, end);
+        }
+
+    private:
+        void* context;
+        void (*call)(void*, std::size_t, std::size_t);
+};
+
+// runs the parallel loops of pSystem when it does not use its built-in OpenMP backend
+// implement this to hand the loops to a thread pool the host process already has, so the engine does
+// not start threads of its own that fight it for cores
+class Executor {
+    public:
+        virtual ~Executor() = default;
+        virtual const char* name() const = 0;
+        // number of threads loops are spread over, used to size chunks
+        virtual int concurrency() const = 0;
+        // calls body on disjoint ranges covering [begin, end), ranges should be about grain long
+        // returns when all of them are done
+        virtual void parallelFor(std::size_t begin, std::size_t end, std::size_t grain, RangeFunction body) = 0;
+};
+
+// runs every loop on the calling thread
+class SerialExecutor : public Executor {
+    public:
+        const char* name() const override;
+        int concurrency() const override;
+        void parallelFor(std::size_t begin, std::size_t end, std::size_t grain, RangeFunction body) override;
+};
+
+// runs loops on the in-tree work-stealing pool; one pool can be shared by several systems stepped from
+// different threads, their loops then take turns on it
+class PoolExecutor : public Executor {
+    public:
+        explicit PoolExecutor(std::shared_ptr<WorkStealingPool> in_pool);
+        const char* name() const override;
+        int concurrency() const override;
+        void parallelFor(std::size_t begin, std::size_t end, std::size_t grain, RangeFunction body) override;
+        const std::shared_ptr<WorkStealingPool>& getPool() const;
+
+    private:
+        std::shared_ptr<WorkStealingPool> pool;
+};
+
+// true if the library was built with OpenMP, without it the OpenMP backend runs serially
+bool openMPAvailable();
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef fixed_h
+#define fixed_h
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+
+#include "particle.hpp"
+#include "isa.hpp"
+
+// largest system with a fixed-size engine, every size up to it is one instantiation of FixedSystem
+const int maxFixedBodies = 16;
+
+// engine for systems of exactly N bodies, such as our 9-body solar system. The state is copied into
+// arrays on the stack for a run of steps, the pair loops have compile-time bounds and are unrolled, and
+// every pair is visited once with its force applied to both bodies, so a step has no branches other than
+// those of a spline or truncated force law. evolveFixed runs it compiled for the active level of isa.hpp.
+// Steps and force laws are those of pSystem; the pairs are summed in another order, so results agree with
+// the generic loops to rounding and not bit for bit
+template<int N>
+class FixedSystem {
+    public:
+        // masses, and x,y,z triples of positions and velocities
+        FixedSystem(const double* masses, const double* positions, const double* velocities);
+
+        template<class Law>
+        void evolve(long steps, double dt, const Law& law, Integrator integrator);
+        void store(double* positions, double* velocities) const;
+
+    private:
+        using Values = std::array<double, N>;
+        struct State {
+            Values x, y, z, vx, vy, vz;
+        };
+
+        template<class Law>
+        static void forces(const Values& m, const State& s, const Law& law, Values& ax, Values& ay, Values& az);
+
+        Values m;
+        State state;
+};
+
+template<int N>
+FixedSystem<N>::FixedSystem(const double* masses, const double* positions, const double* velocities){
+    for(int i=0; i<N; i++){
+        m[i] = masses[i];
+        state.x[i] = positions[3*i];
+        state.y[i] = positions[3*i + 1];
+        state.z[i] = positions[3*i + 2];
+        state.vx[i] = velocities[3*i];
+        state.vy[i] = velocities[3*i + 1];
+        state.vz[i] = velocities[3*i + 2];
+    }
+}
+
+template<int N>
+void FixedSystem<N>::store(double* positions, double* velocities) const{
+    for(int i=0; i<N; i++){
+        positions[3*i] = state.x[i];
+        positions[3*i + 1] = state.y[i];
+        positions[3*i + 2] = state.z[i];
+        velocities[3*i] = state.vx[i];
+        velocities[3*i + 1] = state.vy[i];
+        velocities[3*i + 2] = state.vz[i];
+    }
+}
+
+template<int N>
+template<class Law>
+NBODY_KERNEL void FixedSystem<N>::forces(const Values& m, const State& s, const Law& law, Values& ax, Values& ay, Values& az){
+    ax.fill(0.0);
+    ay.fill(0.0);
+    az.fill(0.0);
+    #pragma GCC unroll 16
+    for(int i=0; i<N; i++){
+        #pragma GCC unroll 16
+        for(int j=i + 1; j<N; j++){
+            const double dx = s.x[j] - s.x[i];
+            const double dy = s.y[j] - s.y[i];
+            const double dz = s.z[j] - s.z[i];
+            const double scale = law.scale(dx*dx + dy*dy + dz*dz);
+            const double si = m[j]*scale;
+            const double sj = m[i]*scale;
+            ax[i] += si*dx;
+            ay[i] += si*dy;
+            az[i] += si*dz;
+            ax[j] -= sj*dx;
+            ay[j] -= sj*dy;
+            az[j] -= sj*dz;
+        }
+    }
+}
+
+template<int N>
+template<class Law>
+NBODY_KERNEL void FixedSystem<N>::evolve(long steps, double dt, const Law& law, Integrator integrator){
+    // local copies, so nothing aliases the state during the run and the compiler is free to keep it in registers
+    const Values masses = m;
+    State s = state;
+    Values ax, ay, az;
+    auto drift = [&](double h){
+        for(int i=0; i<N; i++){
+            s.x[i] += h*s.vx[i];
+            s.y[i] += h*s.vy[i];
+            s.z[i] += h*s.vz[i];
+        }
+    };
+    auto kick = [&](double h){
+        for(int i=0; i<N; i++){
+            s.vx[i] += h*ax[i];
+            s.vy[i] += h*ay[i];
+            s.vz[i] += h*az[i];
+        }
+    };
+    if(integrator == Integrator::euler){
+        for(long step=0; step<steps; step++){
+            forces(masses, s, law, ax, ay, az);
+            drift(dt);
+            kick(dt);
+        }
+    }else if(steps > 0){
+        // drift-kick-drift with the closing half drift of a step and the opening one of the next fused
+        drift(0.5*dt);
+        for(long step=0; step<steps; step++){
+            forces(masses, s, law, ax, ay, az);
+            kick(dt);
+            drift(step + 1 < steps ? dt : 0.5*dt);
+        }
+    }
+    state = s;
+}
+
+// runs steps of a system of n bodies in the FixedSystem of its size, updating positions and velocities
+// (x,y,z triples) in place; returns false without touching them if n is 0 or above maxFixedBodies
+bool evolveFixed(std::size_t n, const double* masses, double* positions, double* velocities, long steps,
+                 double dt, ForceLaw law, double epsilon, double cutoff, Integrator integrator);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef forcelaw_h
+#define forcelaw_h
+
+#include <cmath>
+#include <Eigen/Core>
+
+// how the pair force is softened at small separations r, with epsilon the softening length:
+// plummer is m*d/(r^2 + epsilon^2)^1.5, plain Newtonian gravity when epsilon is 0;
+// spline is Newtonian beyond epsilon and inside it the force of a cubic spline mass distribution (as in
+// GADGET), which goes smoothly to zero at r=0; truncated is the plummer force within a cutoff radius and
+// zero beyond it
+enum class ForceLaw { plummer, spline, truncated };
+
+// force-law policies for the pair kernels: scale(r2) is the factor the separation vector d (pointing to
+// the other body, r2 = |d|^2) times the mass of the other body is multiplied by. Every law is its own
+// type, so every kernel instantiated with one is a loop with no check of the law or of its parameters
+struct UnsoftenedLaw {
+    double scale(double r2) const{
+        return 1.0/(r2*std::sqrt(r2));
+    }
+};
+
+struct PlummerLaw {
+    double eps2;
+
+    double scale(double r2) const{
+        const double s = r2 + eps2;
+        return 1.0/(s*std::sqrt(s));
+    }
+};
+
+struct SplineLaw {
+    double h;
+    double invH3;
+
+    double scale(double r2) const{
+        const double r = std::sqrt(r2);
+        const double u = r/h;
+        // all three pieces are evaluated and one is selected, so the SoA kernels can vectorise it
+        const double outside = 1.0/(r2*r);
+        const double inner = invH3*(32.0/3.0 + u*u*(32.0*u - 38.4));
+        const double outer = invH3*(64.0/3.0 - 48.0*u + 38.4*u*u - 32.0/3.0*u*u*u - 1.0/(15.0*u*u*u));
+        return u >= 1.0 ? outside : (u < 0.5 ? inner : outer);
+    }
+};
+
+struct TruncatedLaw {
+    double eps2;
+    double cutoff2;
+
+    double scale(double r2) const{
+        const double s = r2 + eps2;
+        return r2 < cutoff2 ? 1.0/(s*std::sqrt(s)) : 0.0;
+    }
+};
+
+// acceleration of a body at from due to a body of mass at to
+template<class Law>
+inline Eigen::Vector3d pairAcceleration(const Law& law, const Eigen::Vector3d& from, const Eigen::Vector3d& to, double mass){
+    const Eigen::Vector3d d = to - from;
+    return (mass*law.scale(d.squaredNorm()))*d;
+}
+
+// calls kernel with the policy of law for this epsilon and cutoff; runs look at the law once, here.
+// Softening with epsilon 0 is unsoftened gravity, so plummer and spline give UnsoftenedLaw then
+template<class Kernel>
+void withForceLaw(ForceLaw law, double epsilon, double cutoff, Kernel&& kernel){
+    if(law == ForceLaw::truncated)
+        kernel(TruncatedLaw{epsilon*epsilon, cutoff*cutoff});
+    else if(epsilon == 0.0)
+        kernel(UnsoftenedLaw{});
+    else if(law == ForceLaw::spline)
+        kernel(SplineLaw{epsilon, 1.0/(epsilon*epsilon*epsilon)});
+    else
+        kernel(PlummerLaw{epsilon*epsilon});
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef isa_h
+#define isa_h
+
+// instruction set levels the SoA kernels (the fixed-size engine, batches and the row kernels of the generic
+// loops) are compiled for. One binary
+// holds a version of every kernel for each level and uses the widest one the cpu supports, so it does not
+// need -march and still runs everywhere. The versions do the same operations in the same order, without
+// fused multiply-adds, so every level gives the same bits
+enum class VectorIsa { sse2, sse42, avx2, avx512 };
+
+const char* isaName(VectorIsa isa);
+// widest level this cpu supports, from CPUID and the registers the OS saves
+VectorIsa detectVectorIsa();
+// level the kernels run at: the detected one, or a lower one asked for with NBODY_ISA=sse2|sse4.2|avx2|avx512
+// in the environment; picked once, on first use
+VectorIsa activeVectorIsa();
+// switches the kernels to another level, mostly for testing; throws invalid_argument above the detected one
+void setVectorIsa(VectorIsa isa);
+
+// the version of a kernel for the active level
+template<class Kernel>
+Kernel forVectorIsa(Kernel sse2, Kernel sse42, Kernel avx2, Kernel avx512){
+    switch(activeVectorIsa()){
+        case VectorIsa::avx512: return avx512;
+        case VectorIsa::avx2: return avx2;
+        case VectorIsa::sse42: return sse42;
+        default: return sse2;
+    }
+}
+
+// a kernel body is written once as an always-inlined function and wrapped in one function per level with
+// the target attribute below, so the whole body is compiled for that level; elsewhere every level is the baseline
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NBODY_KERNEL inline __attribute__((always_inline))
+#define NBODY_TARGET_SSE42 __attribute__((target("sse4.2")))
+#define NBODY_TARGET_AVX2 __attribute__((target("avx2")))
+#define NBODY_TARGET_AVX512 __attribute__((target("avx512f,prefer-vector-width=512")))
+#else
+#define NBODY_KERNEL inline
+#define NBODY_TARGET_SSE42
+#define NBODY_TARGET_AVX2
+#define NBODY_TARGET_AVX512
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef jobfile_h
+#define jobfile_h
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// every option of one run of the simulator, with the defaults of the command line; the keys of a job
+// file are the long option names (time, timestep, first-touch, ...)
+struct RunConfig {
+    std::string name;
+    // where the run was defined, e.g. jobs.toml:12, for error messages
+    std::string source = "command line";
+
+    double time = 0.0;
+    double timestep = 0.0;
+    double epsilon = 0.0;
+    // initial conditions: n random bodies if nbody > 0, a particle file (CSV as written by --format csv or
+    // --checkpoint) if initial is set, our solar system otherwise
+    int nbody = 0;
+    std::string initial;
+    // of the random bodies or the planets' starting angles
+    int seed = 1;
+    std::string integrator = "euler";
+    std::string forceLaw = "plummer";
+    double cutoff = 0.0;
+
+    int threads = 0;
+    bool smt = false;
+    std::string pin = "none";
+    bool firstTouch = false;
+    std::string decomposition = "auto";
+    int tileSize = 0;
+    bool deterministic = false;
+    bool fixedSize = true;
+    std::string backend;
+    std::string reorder = "none";
+    int reorderInterval = 16;
+    std::string hugePages = "off";
+
+    std::string format = "text";
+    int precision = 6;
+    bool quiet = false;
+    long outputEvery = 0;
+    long checkpointEvery = 0;
+    std::string checkpoint = "checkpoint.csv";
+    long escapers = 0;
+    std::string trace;
+    std::string profile;
+};
+
+// a syntax error or an unknown or mistyped key, what() starts with file:line
+class JobError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+};
+
+// job files are a subset of TOML: comments, key = value lines with strings, integers, floats and booleans,
+// and [[run]] tables. Keys before the first [[run]] apply to every run, each [[run]] is one run; a file
+// without [[run]] tables is a single run. Runs start from defaults, so the command line can supply values
+// the file leaves out
+std::vector<RunConfig> parseJobFile(std::istream& in, const std::string& filename, const RunConfig& defaults);
+// throws JobError if the file can not be read
+std::vector<RunConfig> readJobFile(const std::string& filename, const RunConfig& defaults);
+
+// everything wrong with a run that can be found without running it: values out of range, unknown choices,
+// unreadable initial conditions and output files in missing or read-only directories. Empty if it can run.
+// written are the files earlier runs of the job write, initial conditions among them need not exist yet
+std::vector<std::string> validateRun(const RunConfig& config, const std::vector<std::string>& written = {});
+// the problems of every run, prefixed with where the run was defined, plus runs that would write the same files
+std::vector<std::string> validateJobs(const std::vector<RunConfig>& runs);
+// ensemble members only evolve and report: the options that write files or print during the run are refused
+std::vector<std::string> validateEnsemble(const std::vector<RunConfig>& runs);
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef memory_h
+#define memory_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+// raw blocks for the particle store; blocks of at least mapThreshold bytes are mapped straight from the
+// OS, so their pages stay untouched until the first write and the thread that writes a page first
+// decides on which NUMA node it lives
+void* allocateBlock(std::size_t bytes);
+void freeBlock(void* p, std::size_t bytes);
+const std::size_t mapThreshold = std::size_t(1) << 20;
+
+// 2 MB pages for mapped blocks of at least hugePageSize bytes (the particle store, arenas, node pools),
+// one TLB entry then covers 512 times as much memory
+// transparent asks the kernel to back the block with transparent huge pages (madvise(MADV_HUGEPAGE));
+// reserved maps it from the preallocated hugetlbfs pool (MAP_HUGETLB) and falls back to transparent when
+// the pool is empty. Blocks of hugePageSize or more are always 2 MB aligned and sized, so a block can be
+// freed whatever the policy was when it was allocated
+// process wide, set it before the systems are built
+enum class HugePages { off, transparent, reserved };
+const std::size_t hugePageSize = std::size_t(2) << 20;
+void setHugePages(HugePages policy);
+HugePages getHugePages();
+
+// mapped blocks that got huge pages since the start: bytes from the hugetlbfs pool, bytes advised to use transparent huge
+// pages, and how often reserved pages were asked for but not available
+struct HugePageStats {
+    std::size_t reservedBytes = 0;
+    std::size_t transparentBytes = 0;
+    std::size_t fallbacks = 0;
+};
+HugePageStats hugePageStats();
+// bytes of this process actually backed by huge pages right now (from /proc/self/smaps_rollup), 0 if unknown
+std::size_t residentHugePageBytes();
+
+// allocator for the particle store, construct() without arguments default-initialises, so resize()
+// does not write to the new elements either and they can be filled (first touched) in parallel
+template<class T>
+class ParticleAllocator {
+    public:
+        using value_type = T;
+
+        ParticleAllocator() = default;
+        template<class U>
+        ParticleAllocator(const ParticleAllocator<U>&) {}
+
+        T* allocate(std::size_t n){
+            return static_cast<T*>(allocateBlock(n*sizeof(T)));
+        }
+        void deallocate(T* p, std::size_t n){
+            freeBlock(p, n*sizeof(T));
+        }
+
+        template<class U>
+        void construct(U* p){
+            ::new(static_cast<void*>(p)) U;
+        }
+        template<class U, class... Args>
+        void construct(U* p, Args&&... args){
+            ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+        }
+};
+
+template<class T, class U>
+bool operator==(const ParticleAllocator<T>&, const ParticleAllocator<U>&){ return true; }
+template<class T, class U>
+bool operator!=(const ParticleAllocator<T>&, const ParticleAllocator<U>&){ return false; }
+
+// bump allocator for temporaries that all die at the same time, allocation is a pointer increment and
+// reset() drops everything at once. Blocks are kept across resets; when a step needed more than one block
+// they are merged into one big enough for it, so a run settles on a single block and stops allocating
+// not thread safe, every thread uses its own arena (see ArenaGroup)
+class Arena {
+    public:
+        explicit Arena(std::size_t in_blockSize = 64*1024);
+        ~Arena();
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t));
+        void reset();
+
+        // bytes handed out since the last reset, the most handed out between two resets, and bytes held
+        std::size_t bytesUsed() const;
+        std::size_t peakBytes() const;
+        std::size_t capacity() const;
+        std::uint64_t numResets() const;
+
+    private:
+        struct Block {
+            char* data;
+            std::size_t size;
+        };
+        void addBlock(std::size_t minBytes);
+
+        std::size_t blockSize;
+        std::vector<Block> blocks;
+        std::size_t current = 0;
+        std::size_t offset = 0;
+        std::size_t used = 0;
+        std::size_t peak = 0;
+        std::uint64_t resets = 0;
+};
+
+// one arena per thread, created the first time a thread asks for it
+class ArenaGroup {
+    public:
+        struct Stats {
+            std::size_t bytesUsed = 0;
+            std::size_t peakBytes = 0;
+            std::size_t capacity = 0;
+        };
+
+        ArenaGroup();
+        ArenaGroup(const ArenaGroup&) = delete;
+        ArenaGroup& operator=(const ArenaGroup&) = delete;
+
+        // arena of the calling thread
+        Arena& local();
+        // resets every arena, no thread may be using them
+        void reset();
+
+        // per arena (in order of creation) and summed over all of them
+        std::vector<Stats> arenaStats() const;
+        Stats stats() const;
+
+    private:
+        std::uint64_t serial;
+        mutable std::mutex mutex;
+        std::deque<Arena> arenas;
+        std::vector<std::pair<std::uint64_t, Arena*>> owners;
+};
+
+// STL allocator on an arena, deallocate does nothing; without an arena it falls back to the heap
+template<class T>
+class ArenaAllocator {
+    public:
+        using value_type = T;
+
+        ArenaAllocator(Arena* in_arena = nullptr) : arena{in_arena} {}
+        template<class U>
+        ArenaAllocator(const ArenaAllocator<U>& other) : arena{other.getArena()} {}
+
+        T* allocate(std::size_t n){
+            if(arena)
+                return static_cast<T*>(arena->allocate(n*sizeof(T), alignof(T)));
+            return static_cast<T*>(::operator new(n*sizeof(T)));
+        }
+        void deallocate(T* p, std::size_t){
+            if(!arena)
+                ::operator delete(p);
+        }
+        Arena* getArena() const{
+            return arena;
+        }
+
+    private:
+        Arena* arena;
+};
+
+template<class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b){ return a.getArena() == b.getArena(); }
+template<class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b){ return a.getArena() != b.getArena(); }
+
+// pool of fixed-size slots for long-lived objects such as tree nodes that are created and destroyed one
+// at a time; freed slots go on a free list and are handed out again before a new block is taken
+// not thread safe
+template<class T>
+class ObjectPool {
+    public:
+        struct Stats {
+            std::size_t live = 0;
+            std::size_t peakLive = 0;
+            std::size_t capacity = 0;
+        };
+
+        explicit ObjectPool(std::size_t in_slotsPerBlock = 1024) : slotsPerBlock{in_slotsPerBlock > 0 ? in_slotsPerBlock : 1} {}
+        ~ObjectPool(){
+            // objects still alive are not destroyed, only their memory is returned
+            for(Slot* block : blocks)
+                freeBlock(block, slotsPerBlock*sizeof(Slot));
+        }
+        ObjectPool(const ObjectPool&) = delete;
+        ObjectPool& operator=(const ObjectPool&) = delete;
+
+        template<class... Args>
+        T* create(Args&&... args){
+            if(!freeList){
+                Slot* block = static_cast<Slot*>(allocateBlock(slotsPerBlock*sizeof(Slot)));
+                blocks.push_back(block);
+                for(std::size_t i=slotsPerBlock; i>0; i--){
+                    block[i - 1].next = freeList;
+                    freeList = &block[i - 1];
+                }
+                poolStats.capacity += slotsPerBlock;
+            }
+            // the object overwrites the link, take it off the list first and put it back if construction throws
+            Slot* slot = freeList;
+            freeList = slot->next;
+            T* object;
+            try{
+                object = ::new(static_cast<void*>(slot->storage)) T(std::forward<Args>(args)...);
+            }catch(...){
+                slot->next = freeList;
+                freeList = slot;
+                throw;
+            }
+            poolStats.live++;
+            poolStats.peakLive = std::max(poolStats.peakLive, poolStats.live);
+            return object;
+        }
+        void destroy(T* object){
+            if(object == nullptr)
+                return;
+            object->~T();
+            Slot* slot = reinterpret_cast<Slot*>(object);
+            slot->next = freeList;
+            freeList = slot;
+            poolStats.live--;
+        }
+        const Stats& stats() const{
+            return poolStats;
+        }
+
+    private:
+        union Slot {
+            Slot* next;
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        std::size_t slotsPerBlock;
+        std::vector<Slot*> blocks;
+        Slot* freeList = nullptr;
+        Stats poolStats;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef nbody_c_h
+#define nbody_c_h
+
+/* read-only views of the particle state of a running system, for analysis code in the same process
+   a view points straight at the engine's particle store, nothing is copied; it stays valid until the store
+   changes (a step, reordering, compaction, adding or deleting particles), take new views after that
+   plain C so it can be used from C, Fortran, Python (ctypes/cffi) or C++ built with another compiler */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NBODY_ABI_VERSION 1
+
+/* count elements, element i starts stride bytes after element i - 1; positions and velocities have three
+   doubles (x, y, z) per element, masses one double, ids one uint64_t */
+typedef struct {
+    const void* data;
+    size_t count;
+    size_t stride;
+} nbody_view;
+
+/* a pSystem seen from C */
+typedef struct nbody_system nbody_system;
+
+int nbody_abi_version(void);
+/* number of particles, removes deleted particles first so the views below cover live particles only */
+size_t nbody_count(nbody_system* system);
+nbody_view nbody_positions(nbody_system* system);
+nbody_view nbody_velocities(nbody_system* system);
+nbody_view nbody_masses(nbody_system* system);
+nbody_view nbody_ids(nbody_system* system);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
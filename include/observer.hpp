@@ -0,0 +1,87 @@
+#ifndef observer_h
+#define observer_h
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nbody_c.h"
+
+// read-only state handed to an observer after a step: how many steps the system has taken, its time, and
+// views of the particles (see views.hpp for Eigen maps over them)
+struct StepState {
+    long step;
+    double time;
+    std::size_t count;
+    nbody_view ids;
+    nbody_view masses;
+    nbody_view positions;
+    nbody_view velocities;
+};
+
+using Observer = std::function<void(const StepState&)>;
+
+// inlined observers run on the stepping thread between steps and see the particle store itself;
+// async observers get a copy of the state and run on a background thread while the system steps on
+enum class ObserverMode { inlined, async };
+
+// cost of an observer: stepSeconds is what it took away from the step loop (the call itself for inlined
+// observers, copying the snapshot and waiting for a free one for async ones), observerSeconds the time the
+// observer ran; errors counts exceptions thrown by async observers, which can not be passed on
+struct ObserverStats {
+    std::string name;
+    long every;
+    ObserverMode mode;
+    long calls;
+    double stepSeconds;
+    double observerSeconds;
+    long errors;
+};
+
+// observers registered with a pSystem
+class ObserverSet {
+    public:
+        ObserverSet();
+        ~ObserverSet();
+        ObserverSet(const ObserverSet&) = delete;
+        ObserverSet& operator=(const ObserverSet&) = delete;
+
+        int add(const std::string& name, long every, Observer observer, ObserverMode mode);
+        void remove(int id);
+        bool empty() const;
+
+        // steps from step until the next observer is due
+        long stepsUntilDue(long step) const;
+        // runs the observers due at state.step
+        void notify(const StepState& state);
+        // returns when every queued snapshot has been observed
+        void wait();
+
+        std::vector<ObserverStats> stats() const;
+
+    private:
+        struct Entry;
+        struct Snapshot;
+
+        std::unique_ptr<Snapshot> takeSnapshot(const StepState& state);
+        void workerLoop();
+
+        // entries are never erased, so queued snapshots can refer to them by index
+        std::deque<Entry> entries;
+        mutable std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<std::pair<std::size_t, std::unique_ptr<Snapshot>>> queue;
+        std::vector<std::unique_ptr<Snapshot>> spare;
+        std::size_t busy = 0;
+        bool stopping = false;
+        std::thread worker;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef ordering_h
+#define ordering_h
+
+#include <Eigen/Core>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "executor.hpp"
+#include "memory.hpp"
+
+// space-filling curve the particle store is sorted along, bodies close in space end up close in memory
+// Hilbert keeps neighbouring keys spatially adjacent, Morton is cheaper to compute but jumps at cell edges
+enum class SpaceCurve { none, morton, hilbert };
+
+// keys of the cell (x, y, z) of a 2^21 grid per axis, 63 bits
+std::uint64_t mortonKey(std::uint32_t x, std::uint32_t y, std::uint32_t z);
+std::uint64_t hilbertKey(std::uint32_t x, std::uint32_t y, std::uint32_t z);
+
+// maps positions inside the cube [lo, lo + extent]^3 to keys along a curve
+class CurveEncoder {
+    public:
+        CurveEncoder(SpaceCurve in_curve, const Eigen::Vector3d& in_lo, double extent);
+        std::uint64_t key(const Eigen::Vector3d& position) const;
+
+    private:
+        SpaceCurve curve;
+        Eigen::Vector3d lo;
+        double scale;
+};
+
+// stable LSD radix sort of the keys, 8 bits per pass; passes where every key has the same digit are skipped
+// order receives the original index of every sorted key
+// chunks of the keys are counted and scattered in parallel on the executor, or with OpenMP on the given
+// number of threads if executor is nullptr; the scratch buffers come from the arena if one is given
+void radixSortByKey(std::vector<std::uint64_t>& keys, std::vector<std::uint32_t>& order, Executor* executor, int threads,
+                    Arena* scratch = nullptr);
+
+// fraction of neighbouring keys that are out of order: 0 right after sorting, about 0.5 for a random order
+double curveDisorder(const std::vector<std::uint64_t>& keys);
+
+// periodic reordering: how often it was checked and done, the current check interval in steps and the
+// disorder found at the last check
+struct ReorderStats {
+    long checks = 0;
+    long reorders = 0;
+    long interval = 0;
+    double disorder = 0.0;
+};
+
+#endif
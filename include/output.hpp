@@ -0,0 +1,28 @@
+#ifndef output_h
+#define output_h
+
+#include <cstddef>
+#include <string>
+
+#include "observer.hpp"
+
+// text is the block per particle the simulator always printed, csv and tsv one row per particle
+// (id, mass, x, y, z, vx, vy, vz) after a header line
+enum class OutputFormat { text, csv, tsv };
+
+struct OutputOptions {
+    OutputFormat format = OutputFormat::text;
+    // significant digits of every number, 1 to 17 (17 round-trips a double)
+    int precision = 6;
+};
+
+// header line of the format, empty for text
+void formatHeader(const OutputOptions& options, std::string& out);
+// appends particles begin to end of the state to out; numbers are formatted with std::to_chars, which
+// neither allocates nor looks at the locale, so chunks can be formatted on any number of threads
+void formatRows(const StepState& state, std::size_t begin, std::size_t end, const OutputOptions& options,
+                std::string& out);
+// writes all size bytes to the file descriptor, retrying short and interrupted writes; false on an error
+bool writeAll(int fd, const char* data, std::size_t size);
+
+#endif
@@ -10,6 +10,15 @@
 #include <math.h>
 #include <chrono>
 #include <tuple>
+#include "memory.hpp"
+#include "planner.hpp"
+#include "executor.hpp"
+#include "ordering.hpp"
+#include "nbody_c.h"
+#include "observer.hpp"
+#include "output.hpp"
+#include "forcelaw.hpp"
+#include "rows.hpp"
 
 // Basic data type for simulation particle=body in the solar system
 // only functionality is the update method, other system evolution functionalities are implemented
@@ -22,12 +31,21 @@ class Particle {
         const Eigen::Vector3d& getPosition() const;
         const Eigen::Vector3d& getVelocity() const;
         const Eigen::Vector3d& getAcceleration() const;
-        void addAcceleration(Eigen::Vector3d a);
+        // stable id given by the pSystem the particle was added to, it survives reordering and compaction
+        std::uint64_t getId() const;
+        void addAcceleration(const Eigen::Vector3d& a);
         void update(double dt);
         void print() const;
         
 
     private:
+        // leaves the particle uninitialised, id included, only used by the particle store to allocate without
+        // touching memory, so resize() does not first touch the pages the threads are meant to place
+        Particle() {}
+        template<class> friend class ParticleAllocator;
+        friend class pSystem;
+
+        std::uint64_t id;
         double mass;
         Eigen::Vector3d position;
         Eigen::Vector3d velocity;
@@ -36,6 +54,14 @@ class Particle {
 };
 
 
+// fields of the particle store that can be viewed in place
+enum class ParticleField { id, mass, position, velocity };
+
+// euler is the explicit first order scheme the simulator always used; leapfrog is the second order,
+// symplectic drift-kick-drift scheme, which keeps the energy error bounded over long runs for the same single
+// force calculation per step
+enum class Integrator { euler, leapfrog };
+
 // container to store a system of interacting particles
 // system can be manually populated with particles, and then the evolveSystem
 // function handles everything evolution related
@@ -44,13 +70,42 @@ class pSystem {
         pSystem();
         // populate the system with the following functions
         void addParticle(Particle p);
-        void deleteParticle(int n);
-        Particle &getParticle(int n);
-        void printParticles();
-        int getNumOfParticles();
+        // bulk version: count bodies from arrays of masses and of x,y,z triples of positions and velocities,
+        // built in place and in parallel; ids are given in array order. Throws before adding anything if a mass is not > 0
+        void addParticles(std::size_t count, const double* masses, const double* positions, const double* velocities);
+        void addParticles(const std::vector<double>& masses, const std::vector<Eigen::Vector3d>& positions,
+                          const std::vector<Eigen::Vector3d>& velocities);
+        // with the given ids instead, e.g. those of a checkpoint; they must be unique and above every id given
+        // out so far, the next ones follow the largest. Throws invalid_argument before adding anything otherwise
+        void addParticles(std::size_t count, const std::uint64_t* ids, const double* masses, const double* positions,
+                          const double* velocities);
+        // room for count particles, so adding up to that many does not move the store
+        void reserve(std::size_t count);
+        // O(1): the particle is marked deleted and removed from the store by the next compaction, which runs
+        // before the next step, energy calculation, reordering, addition or output; until then the indices of the other
+        // particles do not change, so a batch of deletions can use the indices from before the batch
+        void deleteParticle(std::size_t n);
+        void deleteParticleById(std::uint64_t id);
+        // removes all deleted particles now, keeping the order and ids of the others
+        void compact();
+
+        // ids are handles that stay valid while the store is reordered and compacted, the table below maps
+        // them to the current index of the particle (noParticle once it has been deleted)
+        static constexpr std::size_t noParticle = ~std::size_t(0);
+        // throws out_of_range for unknown or deleted ids
+        std::size_t indexOf(std::uint64_t id) const;
+        Particle& getParticleById(std::uint64_t id);
+        // indices of count ids at once, unknown or deleted ids give noParticle
+        void indicesOf(const std::uint64_t* ids, std::size_t count, std::size_t* slots) const;
+        Particle &getParticle(std::size_t n);
+        // all particles, formatted in parallel chunks into one buffer that goes out in a single write;
+        // compacts first. Throws runtime_error if the write fails
+        void printParticles(const OutputOptions& options = OutputOptions());
+        void writeParticles(int fd, const OutputOptions& options = OutputOptions());
+        std::size_t getNumOfParticles();
         std::tuple<double, double> getEnergy();
 
-        // calculates acceleration between two particles
+        // calculates acceleration between two particles, with the force law of the system
         Eigen::Vector3d calcAcceleration(const Particle& p1, const Particle& p2, double epsilon);
 
         // updates acceleration parameter for all particles in the system
@@ -61,11 +116,149 @@ class pSystem {
 
         // evolves the system
         void evolveSystem(double t, double dt, double epsilon=0.0);
-        
+        // scheme used by evolveSystem; updateAccelerations and updateVelPos are always the two halves of an euler step
+        void setIntegrator(Integrator in_integrator);
+        Integrator getIntegrator() const;
+        // softening of the pair force (see forcelaw.hpp), plummer by default; truncated needs a cutoff > 0.
+        // The law is picked once per call of evolveSystem or updateAccelerations, the pair loops are compiled for each
+        void setForceLaw(ForceLaw in_forceLaw, double in_cutoff = 0.0);
+        ForceLaw getForceLaw() const;
+        double getCutoff() const;
+
+        // serial/parallel execution, thread count and placement used by the functions above, see ExecutionPlanner
+        // a plan with firstTouch set re-places the particle store straight away
+        void setExecutionPlan(const ExecutionPlan& in_plan);
+        const ExecutionPlan& getExecutionPlan() const;
+        // true if evolveSystem steps the system in the fixed-size engine with the current plan and size rather
+        // than in the generic loops; both run the kernels of the active level of isa.hpp
+        bool usesFixedSize() const;
+
+        // run all parallel loops on an externally supplied executor (e.g. the host's thread pool), whatever
+        // backend the plan asks for; nullptr goes back to the backend of the plan
+        void setExecutor(std::shared_ptr<Executor> in_executor);
+        // nullptr while the built-in OpenMP backend is used
+        const std::shared_ptr<Executor>& getExecutor() const;
+        const char* getBackendName() const;
+
+        // sorts the particle store along the curve, so bodies close in space are close in memory
+        // indices seen by getParticle change, ids do not
+        void reorder(SpaceCurve curve);
+        // reorder during evolveSystem: the ordering is checked every interval steps and the store is sorted
+        // again once it has degraded; the interval doubles while the ordering holds and halves when it
+        // degrades quickly. SpaceCurve::none turns it off
+        void setReordering(SpaceCurve curve, int interval = 16);
+        const ReorderStats& getReorderStats() const;
+
+        // read-only view of one field of all particles, straight on the store; compacts first so it only
+        // covers live particles, and is valid until the store changes. See nbody_c.h and views.hpp
+        nbody_view view(ParticleField field);
+        // views of all fields together with the steps taken and the time simulated, as observers see them
+        StepState getState();
+
+        // per-thread arenas for temporaries, reset by whatever uses them: a run of steps for the partials of the
+        // block decomposition, getEnergy, reordering and the fixed-size engine; their statistics show the bytes
+        // each thread handed out since the last reset and the peak
+        const ArenaGroup& getScratch() const;
+
+        // in-situ analysis: the observer is called after every every-th step of evolveSystem (counted over
+        // all runs of the system) with the state at that step. Inlined observers run between steps on the
+        // stepping thread, async ones on a copy of the state in a background thread; returns an id for removeObserver
+        int addObserver(const std::string& name, long every, Observer observer,
+                        ObserverMode mode = ObserverMode::inlined);
+        void removeObserver(int id);
+        // returns once the async observers have seen every step handed to them
+        void waitForObservers();
+        std::vector<ObserverStats> getObserverStats() const;
+        long getStepCount() const;
+        // continues the step count and time of an earlier run, e.g. one restarted from its checkpoint
+        void setClock(long step, double time);
+        double getTime() const;
+
 
     private:
-        int numParticles;
-        std::vector<Particle> particles;
+        // addParticles after the checks, ids null gives out the next ones
+        void insertParticles(std::size_t count, const std::uint64_t* ids, const double* masses, const double* positions,
+                             const double* velocities);
+        // kernels over a range of rows (blocks for blockRange), for one force-law policy
+        template<class Law>
+        void accelerationRange(std::size_t begin, std::size_t end, const Law& law);
+        template<class Law>
+        void tiledAccelerationRange(std::size_t begin, std::size_t end, const Law& law);
+        template<class Law>
+        void blockRange(std::size_t begin, std::size_t end, const Law& law);
+        void reduceRange(std::size_t begin, std::size_t end);
+        // the euler update, and the parts of leapfrog steps around their force calculations: the opening half
+        // drift, the kick with the full drift that runs into the next step, and the kick with the closing half drift
+        enum class Update { euler, drift, kickDrift, kickHalfDrift };
+        void velPosRange(std::size_t begin, std::size_t end, Update update, double dt);
+        // the positions and masses copied into arrays for the row kernels, at the start of every run; the
+        // updates keep the positions in them current
+        void copyArrays();
+        BodyArrays bodyArrays() const;
+        BodyRecords records(std::size_t begin);
+
+        // worksharing loops used inside the parallel regions of the functions above
+        template<class Law>
+        void forceLoop(const Law& law);
+        void velPosLoop(Update update, double dt);
+        void energyRange(std::size_t begin, std::size_t end, double& E_kin, double& E_pot);
+        // the same phases on an executor
+        template<class Law>
+        void executorForces(const Law& law);
+        void executorVelPos(Update update, double dt);
+        static double pairwiseSum(double* values, std::size_t n);
+        static std::shared_ptr<Executor> makeExecutor(const ExecutionPlan& plan);
+        std::size_t rowGrain() const;
+        void prepareForceLoop();
+        int numThreads() const;
+        void pinThread() const;
+        void placeParticles();
+        // runs the steps in one parallel region or on the executor
+        void runSteps(long steps, double dt, double epsilon);
+        template<class Law>
+        void runStepsWith(long steps, double dt, const Law& law);
+        void fixedSteps(long steps, double dt, double epsilon);
+        void computeKeys(SpaceCurve curve);
+        void sortParticles();
+        void checkOrdering();
+        void notifyObservers();
+
+        std::vector<Particle, ParticleAllocator<Particle>> particles;
+        ExecutionPlan plan;
+        Integrator integrator = Integrator::euler;
+        ForceLaw forceLaw = ForceLaw::plummer;
+        double cutoff = 0.0;
+        std::shared_ptr<Executor> executor;
+        bool externalExecutor = false;
+
+        // partial accelerations of the block decomposition, one per particle per j-tile
+        std::size_t tileSize = 0;
+        std::size_t numTiles = 0;
+        Eigen::Vector3d* partialAcc = nullptr;
+        ArenaGroup scratch;
+        // x, y, z and mass of every particle, one block of particles.size() each
+        std::vector<double, ParticleAllocator<double>> arrays;
+
+        std::uint64_t nextId = 0;
+        // deleted particles (tombstones) waiting for compact()
+        std::size_t numDeleted = 0;
+        // index of every id ever given out
+        std::vector<std::size_t> slotOf;
+        // periodic reordering along a space-filling curve
+        SpaceCurve reorderCurve = SpaceCurve::none;
+        long stepsUntilCheck = 0;
+        ReorderStats reorderStats;
+        std::vector<std::uint64_t> keys;
+        std::vector<std::uint32_t> order;
+        // second particle store the sort copies into, kept so reordering does not allocate
+        std::vector<Particle, ParticleAllocator<Particle>> sortedParticles;
+        // steps taken and time simulated by evolveSystem, as seen by the observers
+        long stepCount = 0;
+        double simTime = 0.0;
+        ObserverSet observers;
+        // formatted chunks of writeParticles, kept so repeated dumps reuse their memory
+        std::vector<std::string> outputChunks;
+        std::string outputBuffer;
 };
 
 // template to enforce Generator uniformity, they must return a unique_ptr to the a pSystem
@@ -82,7 +275,8 @@ class InitialConditionGenerator{
 class solarSysGenerator : public InitialConditionGenerator{
 
     public:
-        solarSysGenerator();
+        // the seed picks the random starting angles of the planets, the same seed gives the same system
+        solarSysGenerator(unsigned seed = 1);
         // return the unique pointer
         std::unique_ptr<pSystem> generateInitialConditions();
 
@@ -96,7 +290,19 @@ class solarSysGenerator : public InitialConditionGenerator{
 class randomSysGenerator : public InitialConditionGenerator{
 
     public:
-        randomSysGenerator(int n);
+        // the seed picks the random bodies, the same seed gives the same system
+        randomSysGenerator(std::size_t n, unsigned seed = 1);
+        // return the unique pointer
+        std::unique_ptr<pSystem> generateInitialConditions();
+};
+
+// reads the particles back from a CSV or TSV file as written by writeParticles (id, mass, x, y, z, vx, vy, vz
+// after a header line), e.g. a checkpoint, keeping their ids. A checkpoint's leading "# step S time T" line
+// restores the step count and time. Throws invalid_argument on bad lines and repeated ids
+class fileSysGenerator : public InitialConditionGenerator{
+
+    public:
+        fileSysGenerator(const std::string& filename);
         // return the unique pointer
         std::unique_ptr<pSystem> generateInitialConditions();
 };
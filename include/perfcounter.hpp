@@ -0,0 +1,34 @@
+#ifndef perfcounter_h
+#define perfcounter_h
+
+#include <cstdint>
+#include <vector>
+
+// hardware event counter (Linux perf_event_open), counts user space only
+// unavailable on other systems, in containers without perf support, or when
+// /proc/sys/kernel/perf_event_paranoid forbids it; read() is 0 then
+class PerfCounter {
+    public:
+        enum class Event { dtlbLoads, dtlbLoadMisses };
+        // thread counts the calling thread; process counts every thread of the process that exists when the
+        // counter is made (such as the OpenMP or pool workers doing the force loops) with one counter each,
+        // summed by read(), plus the threads they start later once those have exited
+        enum class Scope { thread, process };
+
+        explicit PerfCounter(Event event, Scope scope = Scope::thread);
+        ~PerfCounter();
+        PerfCounter(const PerfCounter&) = delete;
+        PerfCounter& operator=(const PerfCounter&) = delete;
+
+        bool available() const;
+        void start();
+        void stop();
+        std::uint64_t read() const;
+        // threads counted
+        int threads() const;
+
+    private:
+        std::vector<int> fds;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef planner_h
+#define planner_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// how threads are bound to cpus: compact fills one socket before the next, scatter deals threads
+// round-robin over the sockets; both use physical cores before SMT siblings
+enum class ThreadPinning { none, compact, scatter };
+
+// how the pair loop is shared between threads: rows gives every thread whole rows i of the force matrix,
+// blocks splits it into (i-tile, j-tile) blocks with per-block partial sums reduced in a fixed order
+enum class ForceDecomposition { rows, blocks };
+
+// what runs the parallel loops of pSystem: its OpenMP regions, the in-tree work-stealing pool, or the
+// calling thread alone
+enum class Backend { openmp, pool, serial };
+
+// tile size of deterministic mode when the plan does not set one
+const int deterministicTileSize = 256;
+
+// logical cpus this process may run on, grouped into physical cores and sockets
+// read from /sys on Linux, every logical cpu counts as its own core elsewhere
+struct CpuTopology {
+    struct Cpu {
+        int id;
+        int core;
+        int socket;
+    };
+    std::vector<Cpu> cpus;
+    int numCores = 1;
+    int numSockets = 1;
+
+    int numLogical() const;
+    bool hasSMT() const;
+    // cpu for each of the given number of threads
+    std::vector<int> placement(ThreadPinning pinning, int threads) const;
+    static CpuTopology detect();
+};
+
+// binds the calling thread to one cpu, does nothing if it is already bound there
+void pinCurrentThread(int cpu);
+
+// how pSystem runs its loops, the default keeps the OpenMP defaults
+struct ExecutionPlan {
+    bool parallel = true;
+    // in a library built without OpenMP pSystem runs this backend on the work-stealing pool
+    Backend backend = Backend::openmp;
+    // 0 uses the OpenMP default (OMP_NUM_THREADS or all logical cpus)
+    int threads = 0;
+    bool useSMT = false;
+    ThreadPinning pinning = ThreadPinning::none;
+    // cpu of every thread, empty if threads are not pinned
+    std::vector<int> cpus;
+    // place the particle store with the same static partition the force loop uses, so on NUMA
+    // machines every socket owns the pages of its slice of particles
+    bool firstTouch = false;
+    ForceDecomposition decomposition = ForceDecomposition::rows;
+    // side length of the blocks, 0 picks one from the number of threads
+    int tileSize = 0;
+    // results do not depend on the thread count, backend or decomposition: every row sums its pairs in
+    // fixed tiles of j (tileSize, or deterministicTileSize if that is 0) and energies are summed in a fixed tree
+    bool deterministic = false;
+    // serial, non-deterministic runs of systems of up to maxFixedBodies bodies step in the FixedSystem of
+    // their size (see fixed.hpp), which agrees with the generic loops to rounding
+    bool fixedSize = false;
+    // why the planner chose this plan
+    std::string reason = "OpenMP defaults";
+
+    std::string describe() const;
+};
+
+// picks serial or parallel execution, the thread count, SMT usage and the decomposition for evolveSystem
+// it models one step as n^2 pair interactions split over the threads plus the cost of the two
+// barriers per step (three for blocks), both measured by a short calibration probe the first time a plan is made
+class ExecutionPlanner {
+    public:
+        ExecutionPlanner(CpuTopology in_topology = CpuTopology::detect());
+
+        // user overrides, they win over the model
+        // threads<=0 keeps the automatic choice, threads==1 means serial
+        void setThreads(int n);
+        // SMT siblings are only used when allowed here or asked for with more threads than cores
+        void setSMT(bool allow);
+        void setPinning(ThreadPinning in_pinning);
+        void setFirstTouch(bool enable);
+        void setDecomposition(ForceDecomposition in_decomposition);
+        void setTileSize(int size);
+        void setBackend(Backend in_backend);
+        void setDeterministic(bool enable);
+        void setFixedSize(bool enable);
+
+        // replace the probe with known costs (seconds per pair interaction and per step of synchronisation
+        // for every thread count, index 0 is unused), mostly for testing
+        void setCalibration(double in_pairCost, std::vector<double> in_syncCost);
+
+        ExecutionPlan plan(std::size_t n);
+
+        const CpuTopology& getTopology() const;
+        double getPairCost() const;
+
+    private:
+        void calibrate();
+        void applyUserOptions(ExecutionPlan& result) const;
+
+        CpuTopology topology;
+        int userThreads = 0;
+        bool userSMT = false;
+        ThreadPinning pinning = ThreadPinning::none;
+        bool firstTouch = false;
+        int userDecomposition = -1;
+        int tileSize = 0;
+        Backend backend;
+        bool deterministic = false;
+        bool fixedSize = false;
+        bool calibrated = false;
+        double pairCost = 0.0;
+        std::vector<double> syncCost;
+};
+
+#endif
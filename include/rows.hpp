@@ -0,0 +1,45 @@
+#ifndef rows_h
+#define rows_h
+
+#include <cstddef>
+
+// partial sums every row kernel below keeps, one per lane: body j of a range goes to lane j%rowLanes (counted
+// from the start of the range) and the lanes are added up in a fixed tree at the end. The lanes do not depend
+// on the width of the registers, so every level of isa.hpp gives the same bits
+const std::size_t rowLanes = 8;
+
+// structure-of-arrays copy of the positions and masses of a pSystem, what the pair loops read
+struct BodyArrays {
+    const double* x;
+    const double* y;
+    const double* z;
+    const double* m;
+};
+
+// particles as they are laid out in the particle store: a field of the k-th one is at its pointer + k*stride
+struct BodyRecords {
+    double* mass;
+    double* position;
+    double* velocity;
+    double* acceleration;
+    std::size_t stride;
+};
+
+// the generic force, update and energy loops of pSystem, compiled for every level of isa.hpp and run at the
+// active one
+
+// acceleration of body i due to the bodies in [begin, end), i itself is skipped; stored in acc[0..2]
+template<class Law>
+void rowAcceleration(const BodyArrays& bodies, std::size_t i, std::size_t begin, std::size_t end, const Law& law,
+                     double* acc);
+// sum of m_j/|r_j - r_i| over the bodies in [begin, end) other than i
+double rowPotential(const BodyArrays& bodies, std::size_t i, std::size_t begin, std::size_t end);
+// updates count particles and writes their new positions to x, y, z. The euler update drifts with the old
+// velocity and then kicks, the leapfrog parts kick and then drift; a kick clears the acceleration, a kick of 0
+// leaves velocity and acceleration alone
+void updateBodies(const BodyRecords& records, std::size_t count, bool euler, double kick, double drift,
+                  double* x, double* y, double* z);
+// kinetic energy of count particles
+double kineticEnergy(const BodyRecords& records, std::size_t count);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef trace_h
+#define trace_h
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "allocation.hpp"
+
+// opt-in timeline tracer, the recorded events can be written in the Chrome trace-event JSON format
+// and opened in about:tracing or ui.perfetto.dev
+// every thread records into its own preallocated buffer, recording an event never takes a lock or
+// allocates; the buffers are only walked when the trace is written
+class Tracer {
+    public:
+        // one complete ("X") event, times are in ns since the tracer was enabled
+        struct Event {
+            const char* name;
+            std::int64_t begin;
+            std::int64_t end;
+        };
+
+        // drop what was recorded and start recording, every thread keeps at most eventsPerThread events,
+        // later ones are dropped; must not be called while other threads are recording
+        static void enable(std::size_t eventsPerThread = 1 << 18);
+        static void disable();
+        static bool enabled() { return active.load(std::memory_order_relaxed); }
+
+        // time since enable() in ns
+        static std::int64_t now();
+        // name must point to a string literal (or any string that outlives the tracer)
+        static void record(const char* name, std::int64_t begin, std::int64_t end);
+
+        // drop all recorded events, must not be called while other threads are recording
+        static void clear();
+        static std::size_t numEvents();
+        static std::size_t numDropped();
+
+        // write all recorded events, returns false if the file could not be written
+        static void writeJSON(std::ostream& out);
+        static bool writeJSON(const std::string& filename);
+
+        // flat profile: the recorded events summed per name over all threads, in order of first appearance
+        struct Total {
+            const char* name;
+            std::uint64_t calls;
+            double seconds;
+            double maxSeconds;
+        };
+        static std::vector<Total> totals();
+        // the totals as CSV (phase, calls, total seconds, mean and longest call in microseconds)
+        static void writeProfile(std::ostream& out);
+        static bool writeProfile(const std::string& filename);
+
+        // per-thread storage, opaque outside trace.cpp
+        struct ThreadBuffer;
+
+    private:
+        static ThreadBuffer& localBuffer();
+
+        using Clock = std::chrono::steady_clock;
+        static std::atomic<bool> active;
+        static std::size_t capacity;
+        static Clock::time_point start;
+};
+
+// records the lifetime of the scope as one event on the calling thread, and makes it the phase
+// allocations are counted in; costs two relaxed loads when neither tracing nor allocation tracking is on
+class TraceScope {
+    public:
+        explicit TraceScope(const char* in_name) : name{in_name}, begin{Tracer::enabled() ? Tracer::now() : -1},
+            tracking{AllocationTracker::enabled()}, previousPhase{tracking ? AllocationTracker::enterPhase(in_name) : nullptr} {}
+        ~TraceScope(){
+            if(begin >= 0)
+                Tracer::record(name, begin, Tracer::now());
+            if(tracking)
+                AllocationTracker::leavePhase(previousPhase);
+        }
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+
+    private:
+        const char* name;
+        std::int64_t begin;
+        bool tracking;
+        const char* previousPhase;
+};
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef views_h
+#define views_h
+
+#include <Eigen/Core>
+#include <cstdint>
+
+#include "nbody_c.h"
+
+class pSystem;
+
+// handle of a system for the C functions in nbody_c.h
+nbody_system* cHandle(pSystem& system);
+
+// Eigen maps over the views of nbody_c.h, so analysis can use Eigen expressions on the engine memory
+// directly: positions and velocities are 3 x count matrices with one body per column
+using VectorsView = Eigen::Map<const Eigen::Matrix<double, 3, Eigen::Dynamic>, Eigen::Unaligned, Eigen::OuterStride<>>;
+using ScalarsView = Eigen::Map<const Eigen::VectorXd, Eigen::Unaligned, Eigen::InnerStride<>>;
+using IdsView = Eigen::Map<const Eigen::Matrix<std::uint64_t, Eigen::Dynamic, 1>, Eigen::Unaligned, Eigen::InnerStride<>>;
+
+VectorsView asVectors(const nbody_view& view);
+ScalarsView asScalars(const nbody_view& view);
+IdsView asIds(const nbody_view& view);
+
+#endif
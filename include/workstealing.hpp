@@ -0,0 +1,112 @@
+#ifndef workstealing_h
+#define workstealing_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Chase-Lev work-stealing deque ("Dynamic circular work-stealing deque", Chase & Lev 2005, with the
+// C11 memory orderings of Le et al. 2013). The owning worker pushes and pops at the bottom without
+// locking, other workers steal from the top with a single CAS.
+// tasks are non-zero 64 bit values, 0 means empty (or a lost race for steal)
+class WorkStealingDeque {
+    public:
+        explicit WorkStealingDeque(std::size_t capacity = 1024);
+        ~WorkStealingDeque();
+        WorkStealingDeque(const WorkStealingDeque&) = delete;
+        WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+        // owner only
+        void push(std::uint64_t task);
+        std::uint64_t pop();
+        // any thread
+        std::uint64_t steal();
+        std::size_t size() const;
+
+    private:
+        struct Ring;
+        Ring* grow(Ring* ring, std::int64_t top, std::int64_t bottom);
+
+        alignas(64) std::atomic<std::int64_t> top{0};
+        alignas(64) std::atomic<std::int64_t> bottom{0};
+        std::atomic<Ring*> ring;
+        // rings replaced by grow() may still be read by a thief, they are freed with the deque
+        std::vector<Ring*> retired;
+};
+
+// fixed set of worker threads that run chunked loops with work stealing
+// a loop starts as one task covering all chunks in the submitting thread's deque; whoever runs a task
+// with more than one chunk splits off the upper half into its own deque, where idle workers can steal
+// it, so work spreads in log(threads) steals and stays where it is when the load is even
+// the thread calling parallelFor takes part as worker 0, so a pool of n threads starts n-1 threads;
+// parallelFor may be called from several threads, their loops run one after the other
+class WorkStealingPool {
+    public:
+        struct Stats {
+            std::uint64_t chunks = 0;
+            std::uint64_t steals = 0;
+            std::uint64_t failedSteals = 0;
+            // time spent looking for work while a loop was running
+            double idleSeconds = 0.0;
+        };
+
+        explicit WorkStealingPool(int threads);
+        ~WorkStealingPool();
+        WorkStealingPool(const WorkStealingPool&) = delete;
+        WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+        int numThreads() const;
+
+        // calls body(chunkBegin, chunkEnd, worker) for chunks of at most grain iterations covering
+        // [begin, end) and returns when all of them are done; body must not throw
+        // a parallelFor from inside a body runs serially on the calling worker
+        template<class F>
+        void parallelFor(std::size_t begin, std::size_t end, std::size_t grain, F&& body){
+            run(begin, end, grain, [](void* context, std::size_t b, std::size_t e, int worker){
+                (*static_cast<typename std::remove_reference<F>::type*>(context))(b, e, worker);
+            }, &body);
+        }
+
+        // per worker and summed over all workers
+        Stats workerStats(int worker) const;
+        Stats stats() const;
+        void resetStats();
+
+    private:
+        using Body = void (*)(void*, std::size_t, std::size_t, int);
+        struct Worker;
+
+        void run(std::size_t begin, std::size_t end, std::size_t grain, Body body, void* context);
+        void workerLoop(int id);
+        // runs tasks until the current loop is finished
+        void work(int id);
+        void execute(int id, std::uint64_t task);
+        std::uint64_t findTask(int id);
+
+        // held by the thread running a loop as worker 0
+        std::mutex submit;
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<std::thread> threads;
+
+        // the loop being run, published before its first task is pushed
+        Body body = nullptr;
+        void* context = nullptr;
+        std::size_t loopBegin = 0;
+        std::size_t loopEnd = 0;
+        std::size_t grain = 1;
+        alignas(64) std::atomic<std::size_t> remaining{0};
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        // bumped for every loop, workers spin on it for a while before sleeping on the condition variable
+        std::atomic<std::uint64_t> epoch{0};
+        bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,105 @@
+// replaces the global operator new and delete so AllocationTracker sees every heap allocation
+// this file is its own CMake target (nbody_alloc_hook), only programs that link it are tracked
+#include "allocation.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace {
+    const bool installHook = (AllocationTracker::install(), true);
+
+    void* allocate(std::size_t bytes){
+        AllocationTracker::record(bytes);
+        if(bytes == 0)
+            bytes = 1;
+        while(true){
+            if(void* p = std::malloc(bytes))
+                return p;
+            std::new_handler handler = std::get_new_handler();
+            if(!handler)
+                throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    void* allocateAligned(std::size_t bytes, std::align_val_t alignment){
+        AllocationTracker::record(bytes);
+        std::size_t align = std::max(static_cast<std::size_t>(alignment), sizeof(void*));
+        if(bytes == 0)
+            bytes = 1;
+        while(true){
+            void* p = nullptr;
+            if(posix_memalign(&p, align, bytes) == 0)
+                return p;
+            std::new_handler handler = std::get_new_handler();
+            if(!handler)
+                throw std::bad_alloc();
+            handler();
+        }
+    }
+}
+
+void* operator new(std::size_t bytes){
+    return allocate(bytes);
+}
+
+void* operator new[](std::size_t bytes){
+    return allocate(bytes);
+}
+
+void* operator new(std::size_t bytes, const std::nothrow_t&) noexcept{
+    try{
+        return allocate(bytes);
+    }catch(...){
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t bytes, const std::nothrow_t&) noexcept{
+    try{
+        return allocate(bytes);
+    }catch(...){
+        return nullptr;
+    }
+}
+
+void* operator new(std::size_t bytes, std::align_val_t alignment){
+    return allocateAligned(bytes, alignment);
+}
+
+void* operator new[](std::size_t bytes, std::align_val_t alignment){
+    return allocateAligned(bytes, alignment);
+}
+
+void operator delete(void* p) noexcept{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept{
+    std::free(p);
+}
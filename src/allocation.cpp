@@ -0,0 +1,125 @@
+#include "allocation.hpp"
+
+#include <cstring>
+
+std::atomic<bool> AllocationTracker::active{false};
+
+namespace {
+    // fixed table so recording never allocates, phases beyond it are counted in the last slot
+    const int maxPhases = 64;
+    const char* const noPhase = "(outside any phase)";
+    const char* const otherPhases = "(other phases)";
+
+    struct PhaseCounter {
+        std::atomic<const char*> name{nullptr};
+        std::atomic<std::uint64_t> allocations{0};
+        std::atomic<std::uint64_t> bytes{0};
+    };
+    PhaseCounter phaseTable[maxPhases];
+    std::atomic<bool> installed{false};
+    std::atomic<std::uint64_t> steps{0};
+
+    thread_local const char* currentPhase = nullptr;
+
+    PhaseCounter& counterFor(const char* name){
+        for(int i=0; i<maxPhases - 1; i++){
+            const char* existing = phaseTable[i].name.load(std::memory_order_acquire);
+            if(existing == nullptr){
+                // claim the free slot, or use it if another thread just claimed it for the same phase
+                if(phaseTable[i].name.compare_exchange_strong(existing, name, std::memory_order_acq_rel))
+                    return phaseTable[i];
+            }
+            if(existing == name || std::strcmp(existing, name) == 0)
+                return phaseTable[i];
+        }
+        phaseTable[maxPhases - 1].name.store(otherPhases, std::memory_order_relaxed);
+        return phaseTable[maxPhases - 1];
+    }
+}
+
+bool AllocationTracker::hooked(){
+    return installed.load(std::memory_order_relaxed);
+}
+
+void AllocationTracker::install(){
+    installed.store(true, std::memory_order_relaxed);
+}
+
+void AllocationTracker::enable(){
+    active.store(true, std::memory_order_relaxed);
+}
+
+void AllocationTracker::disable(){
+    active.store(false, std::memory_order_relaxed);
+}
+
+void AllocationTracker::reset(){
+    for(PhaseCounter& counter : phaseTable){
+        counter.allocations.store(0, std::memory_order_relaxed);
+        counter.bytes.store(0, std::memory_order_relaxed);
+    }
+    steps.store(0, std::memory_order_relaxed);
+}
+
+void AllocationTracker::record(std::size_t bytes){
+    if(!enabled())
+        return;
+    PhaseCounter& counter = counterFor(currentPhase ? currentPhase : noPhase);
+    counter.allocations.fetch_add(1, std::memory_order_relaxed);
+    counter.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+std::uint64_t AllocationTracker::numAllocations(){
+    std::uint64_t total = 0;
+    for(const PhaseCounter& counter : phaseTable)
+        total += counter.allocations.load(std::memory_order_relaxed);
+    return total;
+}
+
+std::uint64_t AllocationTracker::numBytes(){
+    std::uint64_t total = 0;
+    for(const PhaseCounter& counter : phaseTable)
+        total += counter.bytes.load(std::memory_order_relaxed);
+    return total;
+}
+
+std::vector<AllocationTracker::Phase> AllocationTracker::phases(){
+    std::vector<Phase> result;
+    for(const PhaseCounter& counter : phaseTable){
+        const char* name = counter.name.load(std::memory_order_acquire);
+        std::uint64_t allocations = counter.allocations.load(std::memory_order_relaxed);
+        if(name != nullptr && allocations > 0)
+            result.push_back(Phase{name, allocations, counter.bytes.load(std::memory_order_relaxed)});
+    }
+    return result;
+}
+
+void AllocationTracker::countSteps(long in_steps){
+    if(enabled())
+        steps.fetch_add(in_steps, std::memory_order_relaxed);
+}
+
+std::uint64_t AllocationTracker::numSteps(){
+    return steps.load(std::memory_order_relaxed);
+}
+
+void AllocationTracker::report(std::ostream& out){
+    std::uint64_t n = numSteps();
+    out << "allocations: " << numAllocations() << " (" << numBytes() << " bytes) in " << n << " steps" << std::endl;
+    for(const Phase& phase : phases()){
+        out << "  " << phase.name << ": " << phase.allocations << " allocations, " << phase.bytes << " bytes";
+        if(n > 0)
+            out << ", " << double(phase.allocations)/n << " per step";
+        out << std::endl;
+    }
+}
+
+const char* AllocationTracker::enterPhase(const char* name){
+    const char* previous = currentPhase;
+    currentPhase = name;
+    return previous;
+}
+
+void AllocationTracker::leavePhase(const char* previous){
+    currentPhase = previous;
+}
@@ -0,0 +1,326 @@
+#include "batch.hpp"
+#include "trace.hpp"
+#include "isa.hpp"
+
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+    enum Field { mass, x, y, z, vx, vy, vz, ax, ay, az, numFields };
+
+    // the batchLanes values of one field of one body, in a group of n bodies
+    NBODY_KERNEL double* lanesOf(double* group, std::size_t n, int field, std::size_t body){
+        return group + (field*n + body)*batchLanes;
+    }
+    NBODY_KERNEL const double* lanesOf(const double* group, std::size_t n, int field, std::size_t body){
+        return group + (field*n + body)*batchLanes;
+    }
+
+    // accelerations of all bodies of a group; i and j are the same in every lane, so skipping i == j is the
+    // only branch and it is taken by all lanes together
+    template<class Law>
+    NBODY_KERNEL void groupForces(double* group, std::size_t n, const Law& law){
+        for(std::size_t i=0; i<n; i++){
+            const double* xi = lanesOf(group, n, x, i);
+            const double* yi = lanesOf(group, n, y, i);
+            const double* zi = lanesOf(group, n, z, i);
+            alignas(64) double accX[batchLanes] = {};
+            alignas(64) double accY[batchLanes] = {};
+            alignas(64) double accZ[batchLanes] = {};
+            for(std::size_t j=0; j<n; j++){
+                if(i == j)
+                    continue;
+                const double* mj = lanesOf(group, n, mass, j);
+                const double* xj = lanesOf(group, n, x, j);
+                const double* yj = lanesOf(group, n, y, j);
+                const double* zj = lanesOf(group, n, z, j);
+                #pragma omp simd
+                for(std::size_t l=0; l<batchLanes; l++){
+                    const double dx = xj[l] - xi[l];
+                    const double dy = yj[l] - yi[l];
+                    const double dz = zj[l] - zi[l];
+                    const double s = mj[l]*law.scale(dx*dx + dy*dy + dz*dz);
+                    accX[l] += s*dx;
+                    accY[l] += s*dy;
+                    accZ[l] += s*dz;
+                }
+            }
+            double* axi = lanesOf(group, n, ax, i);
+            double* ayi = lanesOf(group, n, ay, i);
+            double* azi = lanesOf(group, n, az, i);
+            #pragma omp simd
+            for(std::size_t l=0; l<batchLanes; l++){
+                axi[l] = accX[l];
+                ayi[l] = accY[l];
+                azi[l] = accZ[l];
+            }
+        }
+    }
+
+    // the fields of a group are contiguous, so the update runs over all bodies and lanes of a field in one loop;
+    // leapfrog kicks and then drifts with the new velocity, euler drifts with the old one and then kicks
+    NBODY_KERNEL void groupUpdate(double* group, std::size_t n, bool euler, double kick, double drift){
+        const std::size_t m = n*batchLanes;
+        for(int d=0; d<3; d++){
+            double* pos = lanesOf(group, n, x + d, 0);
+            double* vel = lanesOf(group, n, vx + d, 0);
+            const double* acc = lanesOf(group, n, ax + d, 0);
+            if(euler){
+                #pragma omp simd
+                for(std::size_t k=0; k<m; k++){
+                    pos[k] += drift*vel[k];
+                    vel[k] += kick*acc[k];
+                }
+            }else{
+                #pragma omp simd
+                for(std::size_t k=0; k<m; k++){
+                    vel[k] += kick*acc[k];
+                    pos[k] += drift*vel[k];
+                }
+            }
+        }
+    }
+
+    template<class Law>
+    NBODY_KERNEL void groupSteps(double* group, std::size_t n, long steps, double dt, const Law& law, bool euler){
+        if(euler){
+            for(long step=0; step<steps; step++){
+                groupForces(group, n, law);
+                groupUpdate(group, n, true, dt, dt);
+            }
+            return;
+        }
+        // drift-kick-drift as pSystem runs it: an opening half drift, full drifts between the kicks and a
+        // closing half drift
+        if(steps > 0)
+            groupUpdate(group, n, false, 0.0, 0.5*dt);
+        for(long step=0; step<steps; step++){
+            groupForces(group, n, law);
+            groupUpdate(group, n, false, dt, step + 1 < steps ? dt : 0.5*dt);
+        }
+    }
+
+    // kinetic and potential energy of every lane of a group
+    NBODY_KERNEL void groupEnergies(const double* group, std::size_t n, double* kin, double* pot){
+        for(std::size_t i=0; i<n; i++){
+            const double* mi = lanesOf(group, n, mass, i);
+            const double* xi = lanesOf(group, n, x, i);
+            const double* yi = lanesOf(group, n, y, i);
+            const double* zi = lanesOf(group, n, z, i);
+            const double* vxi = lanesOf(group, n, vx, i);
+            const double* vyi = lanesOf(group, n, vy, i);
+            const double* vzi = lanesOf(group, n, vz, i);
+            #pragma omp simd
+            for(std::size_t l=0; l<batchLanes; l++)
+                kin[l] += 0.5*mi[l]*(vxi[l]*vxi[l] + vyi[l]*vyi[l] + vzi[l]*vzi[l]);
+            for(std::size_t j=0; j<n; j++){
+                if(i == j)
+                    continue;
+                const double* mj = lanesOf(group, n, mass, j);
+                const double* xj = lanesOf(group, n, x, j);
+                const double* yj = lanesOf(group, n, y, j);
+                const double* zj = lanesOf(group, n, z, j);
+                #pragma omp simd
+                for(std::size_t l=0; l<batchLanes; l++){
+                    const double dx = xj[l] - xi[l];
+                    const double dy = yj[l] - yi[l];
+                    const double dz = zj[l] - zi[l];
+                    pot[l] -= 0.5*mi[l]*mj[l]/std::sqrt(dx*dx + dy*dy + dz*dz);
+                }
+            }
+        }
+    }
+
+    // one version of the kernels per instruction set, see isa.hpp
+    template<class Law>
+    using StepsKernel = void (*)(double*, std::size_t, long, double, const Law&, bool);
+    using EnergyKernel = void (*)(const double*, std::size_t, double*, double*);
+
+    template<class Law>
+    void stepsSse2(double* group, std::size_t n, long steps, double dt, const Law& law, bool euler){
+        groupSteps(group, n, steps, dt, law, euler);
+    }
+    template<class Law>
+    NBODY_TARGET_SSE42 void stepsSse42(double* group, std::size_t n, long steps, double dt, const Law& law, bool euler){
+        groupSteps(group, n, steps, dt, law, euler);
+    }
+    template<class Law>
+    NBODY_TARGET_AVX2 void stepsAvx2(double* group, std::size_t n, long steps, double dt, const Law& law, bool euler){
+        groupSteps(group, n, steps, dt, law, euler);
+    }
+    template<class Law>
+    NBODY_TARGET_AVX512 void stepsAvx512(double* group, std::size_t n, long steps, double dt, const Law& law, bool euler){
+        groupSteps(group, n, steps, dt, law, euler);
+    }
+
+    void energiesSse2(const double* group, std::size_t n, double* kin, double* pot){
+        groupEnergies(group, n, kin, pot);
+    }
+    NBODY_TARGET_SSE42 void energiesSse42(const double* group, std::size_t n, double* kin, double* pot){
+        groupEnergies(group, n, kin, pot);
+    }
+    NBODY_TARGET_AVX2 void energiesAvx2(const double* group, std::size_t n, double* kin, double* pot){
+        groupEnergies(group, n, kin, pot);
+    }
+    NBODY_TARGET_AVX512 void energiesAvx512(const double* group, std::size_t n, double* kin, double* pot){
+        groupEnergies(group, n, kin, pot);
+    }
+}
+
+SystemBatch::SystemBatch(std::size_t in_bodies) : n{in_bodies} {
+    if(n == 0)
+        throw std::invalid_argument("A batch needs systems of at least one body.");
+}
+
+double* SystemBatch::lanes(std::size_t group, int field, std::size_t body){
+    return &data[((group*numFields + field)*n + body)*batchLanes];
+}
+
+const double* SystemBatch::lanes(std::size_t group, int field, std::size_t body) const{
+    return &data[((group*numFields + field)*n + body)*batchLanes];
+}
+
+double SystemBatch::value(std::size_t system, int field, std::size_t body) const{
+    if(system >= count || body >= n)
+        throw std::out_of_range("No body " + std::to_string(body) + " in system " + std::to_string(system) + " of the batch.");
+    return lanes(system/batchLanes, field, body)[system%batchLanes];
+}
+
+std::size_t SystemBatch::add(pSystem& system){
+    system.compact();
+    if(system.getNumOfParticles() != n)
+        throw std::invalid_argument("A batch of " + std::to_string(n) + "-body systems can not take a system of "
+                                    + std::to_string(system.getNumOfParticles()) + " bodies.");
+    const std::size_t group = count/batchLanes;
+    const std::size_t lane = count%batchLanes;
+    // a new group starts with the system in every lane, so the lanes not filled yet step a real system
+    // instead of dividing by zero distances
+    if(lane == 0)
+        data.resize((group + 1)*numFields*n*batchLanes, 0.0);
+    const std::size_t first = lane == 0 ? 0 : lane;
+    const std::size_t last = lane == 0 ? batchLanes : lane + 1;
+    for(std::size_t i=0; i<n; i++){
+        const Particle& p = system.getParticle(i);
+        for(std::size_t l=first; l<last; l++){
+            lanes(group, mass, i)[l] = p.getMass();
+            lanes(group, x, i)[l] = p.getPosition()(0);
+            lanes(group, y, i)[l] = p.getPosition()(1);
+            lanes(group, z, i)[l] = p.getPosition()(2);
+            lanes(group, vx, i)[l] = p.getVelocity()(0);
+            lanes(group, vy, i)[l] = p.getVelocity()(1);
+            lanes(group, vz, i)[l] = p.getVelocity()(2);
+        }
+    }
+    return count++;
+}
+
+std::size_t SystemBatch::size() const{
+    return count;
+}
+
+std::size_t SystemBatch::bodies() const{
+    return n;
+}
+
+void SystemBatch::setIntegrator(Integrator in_integrator){
+    integrator = in_integrator;
+}
+
+Integrator SystemBatch::getIntegrator() const{
+    return integrator;
+}
+
+void SystemBatch::setForceLaw(ForceLaw in_forceLaw, double in_cutoff){
+    if(in_forceLaw == ForceLaw::truncated && !(in_cutoff > 0))
+        throw std::invalid_argument("A truncated force law needs a cutoff radius > 0.");
+    forceLaw = in_forceLaw;
+    cutoff = in_cutoff;
+}
+
+void SystemBatch::setThreads(int in_threads){
+    if(in_threads < 0)
+        throw std::invalid_argument("Thread count must be >= 0.");
+    threads = in_threads;
+}
+
+long SystemBatch::getStepCount() const{
+    return stepCount;
+}
+
+void SystemBatch::evolve(double t, double dt, double epsilon){
+    TraceScope trace("evolveBatch");
+    if(epsilon<0)
+        throw std::invalid_argument("Parameter epsilon must be larger than or equal to zero.");
+
+    // the same step count as pSystem::evolveSystem
+    long steps = 0;
+    for(double t_elapsed = dt; t_elapsed<=t; t_elapsed += dt)
+        steps++;
+
+    const long groups = (count + batchLanes - 1)/batchLanes;
+#ifdef _OPENMP
+    const int numThreads = threads > 0 ? threads : omp_get_max_threads();
+#else
+    const int numThreads = 1;
+#endif
+    const bool euler = integrator == Integrator::euler;
+    withForceLaw(forceLaw, epsilon, cutoff, [&](const auto& law){
+        using Law = std::decay_t<decltype(law)>;
+        StepsKernel<Law> run = forVectorIsa<StepsKernel<Law>>(stepsSse2<Law>, stepsSse42<Law>, stepsAvx2<Law>, stepsAvx512<Law>);
+        #pragma omp parallel for schedule(dynamic) num_threads(numThreads) if(numThreads > 1 && groups > 1)
+        for(long group=0; group<groups; group++){
+            TraceScope trace("batchGroup");
+            run(lanes(group, mass, 0), n, steps, dt, law, euler);
+        }
+    });
+    stepCount += steps;
+}
+
+double SystemBatch::getMass(std::size_t system, std::size_t body) const{
+    return value(system, mass, body);
+}
+
+Eigen::Vector3d SystemBatch::getPosition(std::size_t system, std::size_t body) const{
+    return Eigen::Vector3d(value(system, x, body), value(system, y, body), value(system, z, body));
+}
+
+Eigen::Vector3d SystemBatch::getVelocity(std::size_t system, std::size_t body) const{
+    return Eigen::Vector3d(value(system, vx, body), value(system, vy, body), value(system, vz, body));
+}
+
+std::vector<std::tuple<double, double>> SystemBatch::getEnergies() const{
+    std::vector<std::tuple<double, double>> energies;
+    energies.reserve(count);
+    const std::size_t groups = (count + batchLanes - 1)/batchLanes;
+    EnergyKernel energyKernel = forVectorIsa<EnergyKernel>(energiesSse2, energiesSse42, energiesAvx2, energiesAvx512);
+    for(std::size_t group=0; group<groups; group++){
+        alignas(64) double kin[batchLanes] = {};
+        alignas(64) double pot[batchLanes] = {};
+        energyKernel(lanes(group, mass, 0), n, kin, pot);
+        for(std::size_t l=0; l<batchLanes && group*batchLanes + l<count; l++)
+            energies.emplace_back(kin[l], pot[l]);
+    }
+    return energies;
+}
+
+std::unique_ptr<pSystem> SystemBatch::extract(std::size_t system) const{
+    std::vector<double> masses(n);
+    std::vector<double> positions(3*n);
+    std::vector<double> velocities(3*n);
+    for(std::size_t i=0; i<n; i++){
+        masses[i] = value(system, mass, i);
+        for(int d=0; d<3; d++){
+            positions[3*i + d] = value(system, x + d, i);
+            velocities[3*i + d] = value(system, vx + d, i);
+        }
+    }
+    std::unique_ptr<pSystem> s1 = std::make_unique<pSystem>();
+    s1->setIntegrator(integrator);
+    s1->setForceLaw(forceLaw, cutoff);
+    s1->addParticles(n, masses.data(), positions.data(), velocities.data());
+    return s1;
+}
@@ -0,0 +1,180 @@
+#include "ensemble.hpp"
+#include "batch.hpp"
+#include "workstealing.hpp"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+Ensemble::Ensemble(int in_workers) : workers{in_workers} {
+    if(workers < 0)
+        throw std::invalid_argument("An ensemble needs at least one worker.");
+    if(workers == 0)
+        workers = CpuTopology::detect().numCores;
+}
+
+void Ensemble::add(Member member){
+    if(!member.make)
+        throw std::invalid_argument("Ensemble member " + member.name + " has no system.");
+    members.push_back(std::move(member));
+}
+
+std::size_t Ensemble::size() const{
+    return members.size();
+}
+
+void Ensemble::setBatching(bool in_batching){
+    batching = in_batching;
+}
+
+std::vector<Ensemble::Result> Ensemble::run(){
+    std::vector<Result> results(members.size());
+    std::vector<std::unique_ptr<pSystem>> systems(members.size());
+    std::vector<double> cost(members.size(), 0.0);
+    for(std::size_t i=0; i<members.size(); i++){
+        const Member& member = members[i];
+        Result& result = results[i];
+        result.name = member.name;
+        try{
+            systems[i] = member.make();
+        }catch(const std::exception& e){
+            result.error = e.what();
+            continue;
+        }
+        ExecutionPlan plan;
+        plan.parallel = false;
+        plan.backend = Backend::serial;
+        plan.deterministic = systems[i]->getExecutionPlan().deterministic;
+        plan.tileSize = systems[i]->getExecutionPlan().tileSize;
+        plan.fixedSize = systems[i]->getExecutionPlan().fixedSize;
+        plan.reason = "ensemble member";
+        systems[i]->setExecutionPlan(plan);
+        result.bodies = systems[i]->getNumOfParticles();
+        double n = static_cast<double>(result.bodies);
+        cost[i] = member.timestep > 0 ? n*n*member.time/member.timestep : 0.0;
+    }
+
+    auto runMember = [&](std::size_t i){
+        const Member& member = members[i];
+        Result& result = results[i];
+        pSystem& system = *systems[i];
+        Timer timer;
+        try{
+            std::tuple<double, double> before = system.getEnergy();
+            const long stepsBefore = system.getStepCount();
+            system.evolveSystem(member.time, member.timestep, member.epsilon);
+            std::tuple<double, double> after = system.getEnergy();
+            result.steps = system.getStepCount() - stepsBefore;
+            double E0 = std::get<0>(before) + std::get<1>(before);
+            double E1 = std::get<0>(after) + std::get<1>(after);
+            result.energyChange = (E0 - E1)/E0*100;
+        }catch(const std::exception& e){
+            result.error = e.what();
+        }
+        result.seconds = timer.elapsed();
+        // a finished member gives its memory back straight away
+        systems[i].reset();
+    };
+
+    // members stepped together in one SystemBatch
+    auto runBatch = [&](const std::vector<std::size_t>& batchMembers){
+        const Member& member = members[batchMembers[0]];
+        Timer timer;
+        try{
+            SystemBatch batch(systems[batchMembers[0]]->getNumOfParticles());
+            batch.setIntegrator(systems[batchMembers[0]]->getIntegrator());
+            batch.setForceLaw(systems[batchMembers[0]]->getForceLaw(), systems[batchMembers[0]]->getCutoff());
+            batch.setThreads(1);
+            for(std::size_t i : batchMembers){
+                batch.add(*systems[i]);
+                systems[i].reset();
+            }
+            std::vector<std::tuple<double, double>> before = batch.getEnergies();
+            batch.evolve(member.time, member.timestep, member.epsilon);
+            std::vector<std::tuple<double, double>> after = batch.getEnergies();
+            for(std::size_t k=0; k<batchMembers.size(); k++){
+                Result& result = results[batchMembers[k]];
+                result.steps = batch.getStepCount();
+                double E0 = std::get<0>(before[k]) + std::get<1>(before[k]);
+                double E1 = std::get<0>(after[k]) + std::get<1>(after[k]);
+                result.energyChange = (E0 - E1)/E0*100;
+            }
+        }catch(const std::exception& e){
+            for(std::size_t i : batchMembers)
+                results[i].error = e.what();
+        }
+        const double share = timer.elapsed()/batchMembers.size();
+        for(std::size_t i : batchMembers)
+            results[i].seconds = share;
+    };
+
+    // every task is one member, or with batching the members that can share a batch
+    std::vector<std::vector<std::size_t>> tasks;
+    std::vector<double> taskCost;
+    if(batching){
+        using Key = std::tuple<std::size_t, double, double, double, Integrator, ForceLaw, double>;
+        std::map<Key, std::vector<std::size_t>> alike;
+        for(std::size_t i=0; i<members.size(); i++){
+            if(!systems[i])
+                continue;
+            const Member& member = members[i];
+            alike[Key{results[i].bodies, member.time, member.timestep, member.epsilon,
+                      systems[i]->getIntegrator(), systems[i]->getForceLaw(), systems[i]->getCutoff()}].push_back(i);
+        }
+        for(const auto& entry : alike){
+            const std::vector<std::size_t>& indices = entry.second;
+            for(std::size_t first=0; first<indices.size(); first+=batchLanes){
+                const std::size_t last = std::min(indices.size(), first + batchLanes);
+                tasks.emplace_back(indices.begin() + first, indices.begin() + last);
+            }
+        }
+    }else{
+        for(std::size_t i=0; i<members.size(); i++){
+            if(systems[i])
+                tasks.push_back({i});
+        }
+    }
+    for(const std::vector<std::size_t>& task : tasks){
+        // a batch costs about as much as its largest member
+        double largest = 0.0;
+        for(std::size_t i : task)
+            largest = std::max(largest, cost[i]);
+        taskCost.push_back(largest);
+    }
+
+    std::vector<std::size_t> order(tasks.size());
+    for(std::size_t t=0; t<tasks.size(); t++)
+        order[t] = t;
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b){
+        return taskCost[a] > taskCost[b];
+    });
+
+    Timer wall;
+    WorkStealingPool pool(std::max(1, std::min<int>(workers, static_cast<int>(order.size()))));
+    pool.parallelFor(0, order.size(), 1, [&](std::size_t b, std::size_t e, int){
+        for(std::size_t k=b; k<e; k++){
+            const std::vector<std::size_t>& task = tasks[order[k]];
+            if(task.size() == 1)
+                runMember(task[0]);
+            else
+                runBatch(task);
+        }
+    });
+
+    lastStats = Stats();
+    lastStats.workers = pool.numThreads();
+    lastStats.wallSeconds = wall.elapsed();
+    for(const Result& result : results){
+        if(!result.error.empty())
+            continue;
+        lastStats.systemSteps += result.steps;
+        lastStats.busySeconds += result.seconds;
+    }
+    if(lastStats.wallSeconds > 0)
+        lastStats.systemStepsPerSecond = lastStats.systemSteps/lastStats.wallSeconds;
+    return results;
+}
+
+const Ensemble::Stats& Ensemble::stats() const{
+    return lastStats;
+}
@@ -0,0 +1,47 @@
+#include "executor.hpp"
+
+#include <stdexcept>
+
+const char* SerialExecutor::name() const{
+    return "serial";
+}
+
+int SerialExecutor::concurrency() const{
+    return 1;
+}
+
+void SerialExecutor::parallelFor(std::size_t begin, std::size_t end, std::size_t, RangeFunction body){
+    if(begin < end)
+        body(begin, end);
+}
+
+PoolExecutor::PoolExecutor(std::shared_ptr<WorkStealingPool> in_pool) : pool{std::move(in_pool)} {
+    if(!pool)
+        throw std::invalid_argument("PoolExecutor needs a thread pool.");
+}
+
+const char* PoolExecutor::name() const{
+    return "work-stealing pool";
+}
+
+int PoolExecutor::concurrency() const{
+    return pool->numThreads();
+}
+
+void PoolExecutor::parallelFor(std::size_t begin, std::size_t end, std::size_t grain, RangeFunction body){
+    pool->parallelFor(begin, end, grain, [&body](std::size_t b, std::size_t e, int){
+        body(b, e);
+    });
+}
+
+const std::shared_ptr<WorkStealingPool>& PoolExecutor::getPool() const{
+    return pool;
+}
+
+bool openMPAvailable(){
+#ifdef _OPENMP
+    return true;
+#else
+    return false;
+#endif
+}
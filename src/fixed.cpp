@@ -0,0 +1,64 @@
+#include "fixed.hpp"
+
+#include <type_traits>
+#include <utility>
+
+namespace {
+    template<class Law>
+    using FixedRun = void (*)(const double*, double*, double*, long, double, const Law&, Integrator);
+
+    template<int N, class Law>
+    NBODY_KERNEL void runFixed(const double* masses, double* positions, double* velocities, long steps, double dt,
+                               const Law& law, Integrator integrator){
+        FixedSystem<N> system(masses, positions, velocities);
+        system.evolve(steps, dt, law, integrator);
+        system.store(positions, velocities);
+    }
+
+    // one version per instruction set, see isa.hpp
+    template<int N, class Law>
+    void runSse2(const double* masses, double* positions, double* velocities, long steps, double dt,
+                 const Law& law, Integrator integrator){
+        runFixed<N>(masses, positions, velocities, steps, dt, law, integrator);
+    }
+    template<int N, class Law>
+    NBODY_TARGET_SSE42 void runSse42(const double* masses, double* positions, double* velocities, long steps, double dt,
+                                     const Law& law, Integrator integrator){
+        runFixed<N>(masses, positions, velocities, steps, dt, law, integrator);
+    }
+    template<int N, class Law>
+    NBODY_TARGET_AVX2 void runAvx2(const double* masses, double* positions, double* velocities, long steps, double dt,
+                                   const Law& law, Integrator integrator){
+        runFixed<N>(masses, positions, velocities, steps, dt, law, integrator);
+    }
+    template<int N, class Law>
+    NBODY_TARGET_AVX512 void runAvx512(const double* masses, double* positions, double* velocities, long steps, double dt,
+                                       const Law& law, Integrator integrator){
+        runFixed<N>(masses, positions, velocities, steps, dt, law, integrator);
+    }
+
+    // the versions of every level for n bodies, at n - 1
+    template<class Law>
+    struct FixedRuns {
+        FixedRun<Law> sse2, sse42, avx2, avx512;
+    };
+
+    template<class Law, int... I>
+    const std::array<FixedRuns<Law>, sizeof...(I)>& fixedRuns(std::integer_sequence<int, I...>){
+        static const std::array<FixedRuns<Law>, sizeof...(I)> table{{
+            {&runSse2<I + 1, Law>, &runSse42<I + 1, Law>, &runAvx2<I + 1, Law>, &runAvx512<I + 1, Law>}...}};
+        return table;
+    }
+}
+
+bool evolveFixed(std::size_t n, const double* masses, double* positions, double* velocities, long steps,
+                 double dt, ForceLaw law, double epsilon, double cutoff, Integrator integrator){
+    if(n == 0 || n > static_cast<std::size_t>(maxFixedBodies))
+        return false;
+    withForceLaw(law, epsilon, cutoff, [&](const auto& policy){
+        using Law = std::decay_t<decltype(policy)>;
+        const FixedRuns<Law>& runs = fixedRuns<Law>(std::make_integer_sequence<int, maxFixedBodies>())[n - 1];
+        forVectorIsa(runs.sse2, runs.sse42, runs.avx2, runs.avx512)(masses, positions, velocities, steps, dt, policy, integrator);
+    });
+    return true;
+}
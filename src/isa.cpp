@@ -0,0 +1,67 @@
+#include "isa.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+    // the level from NBODY_ISA, capped at what the cpu supports
+    VectorIsa initialIsa(){
+        const VectorIsa detected = detectVectorIsa();
+        const char* requested = std::getenv("NBODY_ISA");
+        if(requested == nullptr || *requested == '\0')
+            return detected;
+        for(VectorIsa isa : {VectorIsa::sse2, VectorIsa::sse42, VectorIsa::avx2, VectorIsa::avx512}){
+            if(std::strcmp(requested, isaName(isa)) != 0)
+                continue;
+            if(isa > detected){
+                std::cerr << "NBODY_ISA=" << requested << " is not supported by this cpu, using " << isaName(detected) << std::endl;
+                return detected;
+            }
+            return isa;
+        }
+        std::cerr << "Unknown NBODY_ISA=" << requested << " (sse2, sse4.2, avx2 or avx512), using " << isaName(detected) << std::endl;
+        return detected;
+    }
+
+    std::atomic<VectorIsa>& active(){
+        static std::atomic<VectorIsa> isa{initialIsa()};
+        return isa;
+    }
+}
+
+const char* isaName(VectorIsa isa){
+    switch(isa){
+        case VectorIsa::avx512: return "avx512";
+        case VectorIsa::avx2: return "avx2";
+        case VectorIsa::sse42: return "sse4.2";
+        default: return "sse2";
+    }
+}
+
+VectorIsa detectVectorIsa(){
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    // the builtins read CPUID once, and only report avx levels the OS saves the registers of
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        return VectorIsa::avx512;
+    if(__builtin_cpu_supports("avx2"))
+        return VectorIsa::avx2;
+    if(__builtin_cpu_supports("sse4.2"))
+        return VectorIsa::sse42;
+#endif
+    return VectorIsa::sse2;
+}
+
+VectorIsa activeVectorIsa(){
+    return active().load(std::memory_order_relaxed);
+}
+
+void setVectorIsa(VectorIsa isa){
+    if(isa > detectVectorIsa())
+        throw std::invalid_argument(std::string("This cpu does not support ") + isaName(isa) + ".");
+    active().store(isa);
+}
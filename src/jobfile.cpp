@@ -0,0 +1,351 @@
+#include "jobfile.hpp"
+#include "executor.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <unistd.h>
+
+namespace {
+    struct Value {
+        enum class Kind { string, integer, real, boolean } kind = Kind::string;
+        std::string text;
+        long long integer = 0;
+        double real = 0.0;
+        bool boolean = false;
+    };
+
+    const char* kindName(Value::Kind kind){
+        if(kind == Value::Kind::string)
+            return "a string";
+        if(kind == Value::Kind::integer)
+            return "an integer";
+        if(kind == Value::Kind::real)
+            return "a number";
+        return "a boolean";
+    }
+
+    // sets one field of a RunConfig from a value of the right type
+    struct Field {
+        Value::Kind kind;
+        double RunConfig::* real = nullptr;
+        int RunConfig::* integer = nullptr;
+        long RunConfig::* longInteger = nullptr;
+        bool RunConfig::* boolean = nullptr;
+        std::string RunConfig::* text = nullptr;
+    };
+
+    Field field(double RunConfig::* member){ Field f{Value::Kind::real}; f.real = member; return f; }
+    Field field(int RunConfig::* member){ Field f{Value::Kind::integer}; f.integer = member; return f; }
+    Field field(long RunConfig::* member){ Field f{Value::Kind::integer}; f.longInteger = member; return f; }
+    Field field(bool RunConfig::* member){ Field f{Value::Kind::boolean}; f.boolean = member; return f; }
+    Field field(std::string RunConfig::* member){ Field f{Value::Kind::string}; f.text = member; return f; }
+
+    const std::map<std::string, Field>& fields(){
+        static const std::map<std::string, Field> table{
+            {"name", field(&RunConfig::name)},
+            {"time", field(&RunConfig::time)},
+            {"timestep", field(&RunConfig::timestep)},
+            {"epsilon", field(&RunConfig::epsilon)},
+            {"nbody", field(&RunConfig::nbody)},
+            {"initial", field(&RunConfig::initial)},
+            {"seed", field(&RunConfig::seed)},
+            {"integrator", field(&RunConfig::integrator)},
+            {"force-law", field(&RunConfig::forceLaw)},
+            {"cutoff", field(&RunConfig::cutoff)},
+            {"threads", field(&RunConfig::threads)},
+            {"smt", field(&RunConfig::smt)},
+            {"pin", field(&RunConfig::pin)},
+            {"first-touch", field(&RunConfig::firstTouch)},
+            {"decomposition", field(&RunConfig::decomposition)},
+            {"tile-size", field(&RunConfig::tileSize)},
+            {"deterministic", field(&RunConfig::deterministic)},
+            {"fixed-size", field(&RunConfig::fixedSize)},
+            {"backend", field(&RunConfig::backend)},
+            {"reorder", field(&RunConfig::reorder)},
+            {"reorder-interval", field(&RunConfig::reorderInterval)},
+            {"huge-pages", field(&RunConfig::hugePages)},
+            {"format", field(&RunConfig::format)},
+            {"precision", field(&RunConfig::precision)},
+            {"quiet", field(&RunConfig::quiet)},
+            {"output-every", field(&RunConfig::outputEvery)},
+            {"checkpoint-every", field(&RunConfig::checkpointEvery)},
+            {"checkpoint", field(&RunConfig::checkpoint)},
+            {"escapers", field(&RunConfig::escapers)},
+            {"trace", field(&RunConfig::trace)},
+            {"profile", field(&RunConfig::profile)},
+        };
+        return table;
+    }
+
+    // throws the message prefixed with file:line
+    [[noreturn]] void fail(const std::string& where, const std::string& message){
+        throw JobError(where + ": " + message);
+    }
+
+    void assign(RunConfig& config, const std::string& key, const Value& value, const std::string& where){
+        auto found = fields().find(key);
+        if(found == fields().end())
+            fail(where, "unknown key '" + key + "'");
+        const Field& f = found->second;
+        // integers are numbers too
+        bool matches = value.kind == f.kind || (f.kind == Value::Kind::real && value.kind == Value::Kind::integer);
+        if(!matches)
+            fail(where, "'" + key + "' must be " + kindName(f.kind) + ", not " + kindName(value.kind));
+        if(f.real){
+            config.*f.real = value.kind == Value::Kind::integer ? double(value.integer) : value.real;
+        }else if(f.integer){
+            if(value.integer < std::numeric_limits<int>::min() || value.integer > std::numeric_limits<int>::max())
+                fail(where, "'" + key + "' is out of range");
+            config.*f.integer = static_cast<int>(value.integer);
+        }else if(f.longInteger){
+            config.*f.longInteger = static_cast<long>(value.integer);
+        }else if(f.boolean){
+            config.*f.boolean = value.boolean;
+        }else{
+            config.*f.text = value.text;
+        }
+    }
+
+    std::string trim(const std::string& s){
+        std::size_t begin = s.find_first_not_of(" \t\r");
+        if(begin == std::string::npos)
+            return "";
+        std::size_t end = s.find_last_not_of(" \t\r");
+        return s.substr(begin, end - begin + 1);
+    }
+
+    // the line without its comment, a # inside a string is not a comment
+    std::string stripComment(const std::string& line){
+        char quote = 0;
+        for(std::size_t i=0; i<line.size(); i++){
+            char c = line[i];
+            if(quote){
+                if(c == '\\' && quote == '"')
+                    i++;
+                else if(c == quote)
+                    quote = 0;
+            }else if(c == '"' || c == '\''){
+                quote = c;
+            }else if(c == '#'){
+                return line.substr(0, i);
+            }
+        }
+        return line;
+    }
+
+    Value parseValue(const std::string& text, const std::string& where){
+        Value value;
+        if(text.empty())
+            fail(where, "missing value");
+        if(text[0] == '"' || text[0] == '\''){
+            const char quote = text[0];
+            std::size_t i = 1;
+            for(; i<text.size() && text[i] != quote; i++){
+                char c = text[i];
+                // basic strings have escapes, literal ones do not
+                if(c == '\\' && quote == '"'){
+                    if(++i == text.size())
+                        break;
+                    c = text[i];
+                    if(c == 'n')
+                        c = '\n';
+                    else if(c == 't')
+                        c = '\t';
+                    else if(c != '"' && c != '\\')
+                        fail(where, std::string("unsupported escape \\") + c);
+                }
+                value.text += c;
+            }
+            if(i >= text.size())
+                fail(where, "unterminated string");
+            if(i + 1 != text.size())
+                fail(where, "unexpected characters after the string");
+            return value;
+        }
+        if(text == "true" || text == "false"){
+            value.kind = Value::Kind::boolean;
+            value.boolean = text == "true";
+            return value;
+        }
+        if(text[0] == '[' || text[0] == '{')
+            fail(where, "arrays and inline tables are not supported");
+
+        // numbers, with the underscores TOML allows between digits
+        std::string digits;
+        for(char c : text){
+            if(c != '_')
+                digits += c;
+        }
+        errno = 0;
+        char* end = nullptr;
+        if(digits.find_first_of(".eEn") == std::string::npos){
+            value.kind = Value::Kind::integer;
+            value.integer = std::strtoll(digits.c_str(), &end, 10);
+        }else{
+            value.kind = Value::Kind::real;
+            value.real = std::strtod(digits.c_str(), &end);
+        }
+        if(end == digits.c_str() || *end != '\0')
+            fail(where, "'" + text + "' is not a string, number or boolean");
+        if(errno == ERANGE)
+            fail(where, "'" + text + "' is out of range");
+        return value;
+    }
+
+    bool isBareKey(const std::string& key){
+        if(key.empty())
+            return false;
+        return std::all_of(key.begin(), key.end(), [](char c){
+            return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-';
+        });
+    }
+
+    bool oneOf(const std::string& value, std::initializer_list<const char*> choices){
+        return std::any_of(choices.begin(), choices.end(), [&](const char* c){ return value == c; });
+    }
+
+    // false if a file can not be created at path: its directory is missing or not writable
+    bool writable(const std::string& path){
+        std::size_t slash = path.find_last_of('/');
+        std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+        if(access(path.c_str(), F_OK) == 0)
+            return access(path.c_str(), W_OK) == 0;
+        return access(directory.c_str(), W_OK | X_OK) == 0;
+    }
+}
+
+std::vector<RunConfig> parseJobFile(std::istream& in, const std::string& filename, const RunConfig& defaults){
+    RunConfig common = defaults;
+    common.source = filename;
+    std::vector<RunConfig> runs;
+    std::vector<std::string> keys;
+    std::string line;
+    int lineNumber = 0;
+    while(std::getline(in, line)){
+        lineNumber++;
+        const std::string where = filename + ":" + std::to_string(lineNumber);
+        std::string content = trim(stripComment(line));
+        if(content.empty())
+            continue;
+        if(content[0] == '['){
+            if(content != "[[run]]")
+                fail(where, "only [[run]] tables are supported, not " + content);
+            // every run starts from the keys above the first table
+            runs.push_back(common);
+            runs.back().source = where;
+            keys.clear();
+            continue;
+        }
+        std::size_t equals = content.find('=');
+        if(equals == std::string::npos)
+            fail(where, "expected key = value");
+        std::string key = trim(content.substr(0, equals));
+        if(!isBareKey(key))
+            fail(where, "'" + key + "' is not a valid key");
+        if(std::find(keys.begin(), keys.end(), key) != keys.end())
+            fail(where, "'" + key + "' is set twice");
+        keys.push_back(key);
+        Value value = parseValue(trim(content.substr(equals + 1)), where);
+        assign(runs.empty() ? common : runs.back(), key, value, where);
+    }
+    if(runs.empty())
+        runs.push_back(common);
+    for(std::size_t i=0; i<runs.size(); i++){
+        if(runs[i].name.empty())
+            runs[i].name = "run " + std::to_string(i + 1);
+    }
+    return runs;
+}
+
+std::vector<RunConfig> readJobFile(const std::string& filename, const RunConfig& defaults){
+    std::ifstream file(filename);
+    if(!file)
+        throw JobError(filename + ": can not be read");
+    return parseJobFile(file, filename, defaults);
+}
+
+std::vector<std::string> validateRun(const RunConfig& c, const std::vector<std::string>& written){
+    std::vector<std::string> problems;
+    auto check = [&](bool ok, const std::string& message){
+        if(!ok)
+            problems.push_back(message);
+    };
+    check(c.time > 0, "time must be > 0");
+    check(c.timestep > 0, "timestep must be > 0");
+    check(c.timestep <= c.time || !(c.time > 0), "timestep is longer than the whole run");
+    check(c.epsilon >= 0, "epsilon must be >= 0");
+    check(c.nbody >= 0, "nbody must be >= 0");
+    check(c.seed >= 0, "seed must be >= 0");
+    check(c.nbody == 0 || c.initial.empty(), "nbody and initial both set the initial conditions, give only one");
+    check(c.initial.empty() || access(c.initial.c_str(), R_OK) == 0 ||
+          std::find(written.begin(), written.end(), c.initial) != written.end(),
+          "initial conditions " + c.initial + " can not be read");
+    check(oneOf(c.integrator, {"euler", "leapfrog"}), "integrator must be euler or leapfrog, not " + c.integrator);
+    check(oneOf(c.forceLaw, {"plummer", "spline", "truncated"}), "force-law must be plummer, spline or truncated, not " + c.forceLaw);
+    check(c.forceLaw != "truncated" || c.cutoff > 0, "force-law truncated needs a cutoff > 0");
+    check(c.threads >= 0, "threads must be >= 0");
+    check(oneOf(c.pin, {"none", "compact", "scatter"}), "pin must be none, compact or scatter, not " + c.pin);
+    check(oneOf(c.decomposition, {"auto", "rows", "blocks"}), "decomposition must be auto, rows or blocks, not " + c.decomposition);
+    check(c.tileSize >= 0, "tile-size must be >= 0");
+    check(oneOf(c.backend, {"", "openmp", "pool", "serial"}), "backend must be openmp, pool or serial, not " + c.backend);
+    check(c.backend != "openmp" || openMPAvailable(), "backend openmp is not available, the simulator was built without OpenMP");
+    check(oneOf(c.reorder, {"none", "morton", "hilbert"}), "reorder must be none, morton or hilbert, not " + c.reorder);
+    check(c.reorderInterval >= 1, "reorder-interval must be >= 1");
+    check(oneOf(c.hugePages, {"off", "transparent", "reserved"}), "huge-pages must be off, transparent or reserved, not " + c.hugePages);
+    check(oneOf(c.format, {"text", "csv", "tsv"}), "format must be text, csv or tsv, not " + c.format);
+    check(c.precision >= 1 && c.precision <= 17, "precision must be between 1 and 17");
+    check(c.outputEvery >= 0, "output-every must be >= 0");
+    check(c.checkpointEvery >= 0, "checkpoint-every must be >= 0");
+    check(c.escapers >= 0, "escapers must be >= 0");
+    check(c.checkpointEvery == 0 || writable(c.checkpoint), "checkpoint " + c.checkpoint + " can not be written");
+    check(c.trace.empty() || writable(c.trace), "trace " + c.trace + " can not be written");
+    check(c.profile.empty() || writable(c.profile), "profile " + c.profile + " can not be written");
+    return problems;
+}
+
+std::vector<std::string> validateJobs(const std::vector<RunConfig>& runs){
+    std::vector<std::string> problems;
+    // files written by earlier runs, to catch runs overwriting each other's results
+    std::map<std::string, std::string> writers;
+    std::vector<std::string> written;
+    auto claim = [&](const RunConfig& run, const std::string& file){
+        written.push_back(file);
+        auto claimed = writers.emplace(file, run.name);
+        if(!claimed.second && claimed.first->second != run.name)
+            problems.push_back(run.source + ": " + run.name + " writes " + file + ", which " + claimed.first->second + " writes too");
+        else if(!claimed.second)
+            problems.push_back(run.source + ": " + run.name + " writes " + file + " twice");
+    };
+    for(const RunConfig& run : runs){
+        for(const std::string& problem : validateRun(run, written))
+            problems.push_back(run.source + ": " + run.name + ": " + problem);
+        if(run.checkpointEvery > 0)
+            claim(run, run.checkpoint);
+        if(!run.trace.empty())
+            claim(run, run.trace);
+        if(!run.profile.empty())
+            claim(run, run.profile);
+    }
+    return problems;
+}
+
+std::vector<std::string> validateEnsemble(const std::vector<RunConfig>& runs){
+    std::vector<std::string> problems;
+    for(const RunConfig& run : runs){
+        auto refuse = [&](bool set, const char* option){
+            if(set)
+                problems.push_back(run.source + ": " + run.name + ": " + option + " is not supported in an ensemble");
+        };
+        refuse(run.outputEvery > 0, "output-every");
+        refuse(run.checkpointEvery > 0, "checkpoint-every");
+        refuse(run.escapers > 0, "escapers");
+        refuse(!run.trace.empty(), "trace");
+        refuse(!run.profile.empty(), "profile");
+    }
+    return problems;
+}
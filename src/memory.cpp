@@ -0,0 +1,259 @@
+#include "memory.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace {
+    std::atomic<HugePages> hugePages{HugePages::off};
+    std::atomic<std::size_t> reservedBytes{0};
+    std::atomic<std::size_t> transparentBytes{0};
+    std::atomic<std::size_t> fallbacks{0};
+
+    std::size_t mappedLength(std::size_t bytes){
+        if(bytes < hugePageSize)
+            return bytes;
+        return (bytes + hugePageSize - 1)/hugePageSize*hugePageSize;
+    }
+
+#ifdef __linux__
+    // maps length bytes (a multiple of hugePageSize) at a 2 MB boundary by mapping one huge page more
+    // and cutting off the ends
+    void* mapAligned(std::size_t length){
+        std::size_t padded = length + hugePageSize;
+        char* p = static_cast<char*>(mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if(p == MAP_FAILED)
+            return nullptr;
+        std::uintptr_t address = reinterpret_cast<std::uintptr_t>(p);
+        std::size_t head = (hugePageSize - address % hugePageSize) % hugePageSize;
+        if(head > 0)
+            munmap(p, head);
+        std::size_t tail = padded - head - length;
+        if(tail > 0)
+            munmap(p + head + length, tail);
+        return p + head;
+    }
+#endif
+}
+
+void setHugePages(HugePages policy){
+    hugePages.store(policy, std::memory_order_relaxed);
+}
+
+HugePages getHugePages(){
+    return hugePages.load(std::memory_order_relaxed);
+}
+
+HugePageStats hugePageStats(){
+    HugePageStats stats;
+    stats.reservedBytes = reservedBytes.load(std::memory_order_relaxed);
+    stats.transparentBytes = transparentBytes.load(std::memory_order_relaxed);
+    stats.fallbacks = fallbacks.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::size_t residentHugePageBytes(){
+    std::ifstream smaps("/proc/self/smaps_rollup");
+    std::string line;
+    std::size_t total = 0;
+    while(std::getline(smaps, line)){
+        std::istringstream fields(line);
+        std::string key;
+        std::size_t kB = 0;
+        fields >> key >> kB;
+        if(key == "AnonHugePages:" || key == "Private_Hugetlb:" || key == "Shared_Hugetlb:")
+            total += kB*1024;
+    }
+    return total;
+}
+
+void* allocateBlock(std::size_t bytes){
+#ifdef __linux__
+    // fresh anonymous mappings are not backed by memory until written, malloc could hand back
+    // pages that another thread touched before
+    if(bytes >= mapThreshold){
+        const std::size_t length = mappedLength(bytes);
+        if(length < hugePageSize){
+            void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(p == MAP_FAILED)
+                throw std::bad_alloc();
+            return p;
+        }
+        HugePages policy = getHugePages();
+#ifdef MAP_HUGETLB
+        if(policy == HugePages::reserved){
+            void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if(p != MAP_FAILED){
+                reservedBytes.fetch_add(length, std::memory_order_relaxed);
+                return p;
+            }
+            // no (or not enough) pages reserved in /proc/sys/vm/nr_hugepages
+            fallbacks.fetch_add(1, std::memory_order_relaxed);
+        }
+#endif
+        void* p = mapAligned(length);
+        if(p == nullptr)
+            throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+        if(policy != HugePages::off && madvise(p, length, MADV_HUGEPAGE) == 0)
+            transparentBytes.fetch_add(length, std::memory_order_relaxed);
+#endif
+        return p;
+    }
+#endif
+    return ::operator new(bytes);
+}
+
+void freeBlock(void* p, std::size_t bytes){
+    if(p == nullptr)
+        return;
+#ifdef __linux__
+    if(bytes >= mapThreshold){
+        munmap(p, mappedLength(bytes));
+        return;
+    }
+#endif
+    ::operator delete(p);
+}
+
+Arena::Arena(std::size_t in_blockSize) : blockSize{std::max<std::size_t>(in_blockSize, 64)} {}
+
+Arena::~Arena(){
+    for(Block& block : blocks)
+        freeBlock(block.data, block.size);
+}
+
+void Arena::addBlock(std::size_t minBytes){
+    std::size_t size = std::max(blockSize, minBytes);
+    blocks.push_back(Block{static_cast<char*>(allocateBlock(size)), size});
+}
+
+void* Arena::allocate(std::size_t bytes, std::size_t alignment){
+    // look for room in the current block and the ones after it, take a new block if none fits
+    while(true){
+        if(current < blocks.size()){
+            Block& block = blocks[current];
+            std::uintptr_t base = reinterpret_cast<std::uintptr_t>(block.data);
+            std::size_t start = ((base + offset + alignment - 1) & ~(std::uintptr_t(alignment) - 1)) - base;
+            if(start + bytes <= block.size){
+                offset = start + bytes;
+                used += bytes;
+                return block.data + start;
+            }
+            if(current + 1 < blocks.size()){
+                current++;
+                offset = 0;
+                continue;
+            }
+        }
+        addBlock(bytes + alignment);
+        current = blocks.size() - 1;
+        offset = 0;
+    }
+}
+
+void Arena::reset(){
+    peak = std::max(peak, used);
+    if(blocks.size() > 1){
+        // this step did not fit into one block, replace them all by one that holds the peak
+        std::size_t total = 0;
+        for(Block& block : blocks){
+            total += block.size;
+            freeBlock(block.data, block.size);
+        }
+        blocks.clear();
+        addBlock(std::max(total, peak + 2*alignof(std::max_align_t)));
+    }
+    current = 0;
+    offset = 0;
+    used = 0;
+    resets++;
+}
+
+std::size_t Arena::bytesUsed() const{
+    return used;
+}
+
+std::size_t Arena::peakBytes() const{
+    return std::max(peak, used);
+}
+
+std::size_t Arena::capacity() const{
+    std::size_t total = 0;
+    for(const Block& block : blocks)
+        total += block.size;
+    return total;
+}
+
+std::uint64_t Arena::numResets() const{
+    return resets;
+}
+
+namespace {
+    // every group gets its own serial number, so a cached arena is never mistaken for one of a
+    // group that was destroyed and reallocated at the same address
+    std::atomic<std::uint64_t> nextGroupSerial{1};
+    thread_local std::uint64_t cachedGroup = 0;
+    thread_local Arena* cachedArena = nullptr;
+    std::atomic<std::uint64_t> nextThreadSerial{1};
+    thread_local std::uint64_t threadSerial = 0;
+}
+
+ArenaGroup::ArenaGroup() : serial{nextGroupSerial.fetch_add(1, std::memory_order_relaxed)} {}
+
+Arena& ArenaGroup::local(){
+    if(cachedGroup == serial)
+        return *cachedArena;
+    if(threadSerial == 0)
+        threadSerial = nextThreadSerial.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(mutex);
+    Arena* arena = nullptr;
+    for(auto& owner : owners){
+        if(owner.first == threadSerial)
+            arena = owner.second;
+    }
+    if(!arena){
+        arenas.emplace_back();
+        arena = &arenas.back();
+        owners.push_back({threadSerial, arena});
+    }
+    cachedGroup = serial;
+    cachedArena = arena;
+    return *arena;
+}
+
+void ArenaGroup::reset(){
+    std::lock_guard<std::mutex> lock(mutex);
+    for(Arena& arena : arenas)
+        arena.reset();
+}
+
+std::vector<ArenaGroup::Stats> ArenaGroup::arenaStats() const{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Stats> result;
+    for(const Arena& arena : arenas){
+        Stats s;
+        s.bytesUsed = arena.bytesUsed();
+        s.peakBytes = arena.peakBytes();
+        s.capacity = arena.capacity();
+        result.push_back(s);
+    }
+    return result;
+}
+
+ArenaGroup::Stats ArenaGroup::stats() const{
+    Stats total;
+    for(const Stats& s : arenaStats()){
+        total.bytesUsed += s.bytesUsed;
+        total.peakBytes += s.peakBytes;
+        total.capacity += s.capacity;
+    }
+    return total;
+}
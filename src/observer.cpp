@@ -0,0 +1,212 @@
+#include "observer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    double seconds(Clock::time_point since){
+        return std::chrono::duration<double>(Clock::now() - since).count();
+    }
+
+    // snapshots in flight at once, the step loop waits for one to come back beyond that
+    const std::size_t maxSnapshots = 2;
+
+    // copies a strided view into a packed array
+    template<class T>
+    void gather(const nbody_view& view, std::size_t width, std::vector<T>& out){
+        out.resize(view.count*width);
+        const char* src = static_cast<const char*>(view.data);
+        for(std::size_t i=0; i<view.count; i++)
+            std::memcpy(&out[i*width], src + i*view.stride, width*sizeof(T));
+    }
+}
+
+struct ObserverSet::Entry {
+    std::string name;
+    long every;
+    Observer observer;
+    ObserverMode mode;
+    bool active = true;
+    long calls = 0;
+    double stepSeconds = 0.0;
+    double observerSeconds = 0.0;
+    long errors = 0;
+};
+
+// packed copy of the state, recycled between steps
+struct ObserverSet::Snapshot {
+    StepState state;
+    std::vector<std::uint64_t> ids;
+    std::vector<double> masses;
+    std::vector<double> positions;
+    std::vector<double> velocities;
+};
+
+ObserverSet::ObserverSet() = default;
+
+ObserverSet::~ObserverSet(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    if(worker.joinable())
+        worker.join();
+}
+
+int ObserverSet::add(const std::string& name, long every, Observer observer, ObserverMode mode){
+    if(every < 1)
+        throw std::invalid_argument("Observer " + name + " must run every >= 1 steps.");
+    if(!observer)
+        throw std::invalid_argument("Observer " + name + " has no function.");
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.emplace_back();
+    Entry& entry = entries.back();
+    entry.name = name;
+    entry.every = every;
+    entry.observer = std::move(observer);
+    entry.mode = mode;
+    // the background thread is only started once something needs it
+    if(mode == ObserverMode::async && !worker.joinable())
+        worker = std::thread([this]{ workerLoop(); });
+    return static_cast<int>(entries.size()) - 1;
+}
+
+void ObserverSet::remove(int id){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(id < 0 || static_cast<std::size_t>(id) >= entries.size())
+        throw std::out_of_range("No observer with id " + std::to_string(id) + ".");
+    entries[id].active = false;
+}
+
+bool ObserverSet::empty() const{
+    std::lock_guard<std::mutex> lock(mutex);
+    for(const Entry& entry : entries){
+        if(entry.active)
+            return false;
+    }
+    return true;
+}
+
+long ObserverSet::stepsUntilDue(long step) const{
+    std::lock_guard<std::mutex> lock(mutex);
+    long next = -1;
+    for(const Entry& entry : entries){
+        if(!entry.active)
+            continue;
+        long until = entry.every - step % entry.every;
+        next = next < 0 ? until : std::min(next, until);
+    }
+    return next;
+}
+
+std::unique_ptr<ObserverSet::Snapshot> ObserverSet::takeSnapshot(const StepState& state){
+    std::unique_ptr<Snapshot> snapshot;
+    {
+        // wait for a snapshot to come back if too many are in flight
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]{ return queue.size() + busy < maxSnapshots || !spare.empty(); });
+        if(!spare.empty()){
+            snapshot = std::move(spare.back());
+            spare.pop_back();
+        }
+    }
+    if(!snapshot)
+        snapshot = std::make_unique<Snapshot>();
+    gather(state.ids, 1, snapshot->ids);
+    gather(state.masses, 1, snapshot->masses);
+    gather(state.positions, 3, snapshot->positions);
+    gather(state.velocities, 3, snapshot->velocities);
+    StepState& copy = snapshot->state;
+    copy.step = state.step;
+    copy.time = state.time;
+    copy.count = state.count;
+    copy.ids = nbody_view{snapshot->ids.data(), state.count, sizeof(std::uint64_t)};
+    copy.masses = nbody_view{snapshot->masses.data(), state.count, sizeof(double)};
+    copy.positions = nbody_view{snapshot->positions.data(), state.count, 3*sizeof(double)};
+    copy.velocities = nbody_view{snapshot->velocities.data(), state.count, 3*sizeof(double)};
+    return snapshot;
+}
+
+void ObserverSet::notify(const StepState& state){
+    // the set only grows, and only from this thread, so the entries can be walked without the lock
+    std::size_t numEntries;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        numEntries = entries.size();
+    }
+    for(std::size_t i=0; i<numEntries; i++){
+        Entry& entry = entries[i];
+        if(!entry.active || state.step % entry.every != 0)
+            continue;
+        Clock::time_point start = Clock::now();
+        if(entry.mode == ObserverMode::inlined){
+            entry.observer(state);
+            double spent = seconds(start);
+            std::lock_guard<std::mutex> lock(mutex);
+            entry.calls++;
+            entry.stepSeconds += spent;
+            entry.observerSeconds += spent;
+        }else{
+            std::unique_ptr<Snapshot> snapshot = takeSnapshot(state);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.emplace_back(i, std::move(snapshot));
+                entry.stepSeconds += seconds(start);
+            }
+            changed.notify_all();
+        }
+    }
+}
+
+void ObserverSet::wait(){
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&]{ return queue.empty() && busy == 0; });
+}
+
+void ObserverSet::workerLoop(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true){
+        changed.wait(lock, [&]{ return stopping || !queue.empty(); });
+        if(queue.empty())
+            return;
+        std::size_t index = queue.front().first;
+        std::unique_ptr<Snapshot> snapshot = std::move(queue.front().second);
+        queue.pop_front();
+        busy++;
+        Entry& entry = entries[index];
+        lock.unlock();
+
+        Clock::time_point start = Clock::now();
+        bool failed = false;
+        try{
+            entry.observer(snapshot->state);
+        }catch(...){
+            failed = true;
+        }
+        double spent = seconds(start);
+
+        lock.lock();
+        entry.calls++;
+        entry.observerSeconds += spent;
+        if(failed)
+            entry.errors++;
+        spare.push_back(std::move(snapshot));
+        busy--;
+        changed.notify_all();
+    }
+}
+
+std::vector<ObserverStats> ObserverSet::stats() const{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ObserverStats> result;
+    for(const Entry& entry : entries){
+        result.push_back(ObserverStats{entry.name, entry.every, entry.mode, entry.calls, entry.stepSeconds,
+                                       entry.observerSeconds, entry.errors});
+    }
+    return result;
+}
@@ -0,0 +1,169 @@
+#include "ordering.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+    const int bitsPerAxis = 21;
+    const std::uint32_t maxCell = (1u << bitsPerAxis) - 1;
+
+    // spreads the low 21 bits of v so there are two zero bits between neighbouring bits
+    std::uint64_t spreadBits(std::uint64_t v){
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffffull;
+        v = (v | v << 16) & 0x1f0000ff0000ffull;
+        v = (v | v << 8) & 0x100f00f00f00f00full;
+        v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+        v = (v | v << 2) & 0x1249249249249249ull;
+        return v;
+    }
+
+    // runs body(chunk) for every chunk, in parallel on the executor or the OpenMP threads
+    template<class F>
+    void forEachChunk(std::size_t chunks, Executor* executor, int threads, F&& body){
+        if(executor){
+            executor->parallelFor(0, chunks, 1, [&](std::size_t b, std::size_t e){
+                for(std::size_t c=b; c<e; c++)
+                    body(c);
+            });
+            return;
+        }
+        const long numChunks = chunks;
+        #pragma omp parallel for num_threads(threads) schedule(static) if(threads > 1)
+        for(long c=0; c<numChunks; c++){
+            body(c);
+        }
+    }
+}
+
+std::uint64_t mortonKey(std::uint32_t x, std::uint32_t y, std::uint32_t z){
+    return spreadBits(x) | spreadBits(y) << 1 | spreadBits(z) << 2;
+}
+
+// J. Skilling, "Programming the Hilbert curve", AIP Conf. Proc. 707 (2004): the coordinates are turned into
+// the "transposed" Hilbert index in place, whose bits are then interleaved like a Morton key
+std::uint64_t hilbertKey(std::uint32_t x, std::uint32_t y, std::uint32_t z){
+    std::uint32_t X[3] = {x & maxCell, y & maxCell, z & maxCell};
+    const std::uint32_t M = 1u << (bitsPerAxis - 1);
+    // inverse undo
+    for(std::uint32_t Q=M; Q>1; Q>>=1){
+        std::uint32_t P = Q - 1;
+        for(int i=0; i<3; i++){
+            if(X[i] & Q){
+                X[0] ^= P;
+            }else{
+                std::uint32_t t = (X[0] ^ X[i]) & P;
+                X[0] ^= t;
+                X[i] ^= t;
+            }
+        }
+    }
+    // gray encode
+    X[1] ^= X[0];
+    X[2] ^= X[1];
+    std::uint32_t t = 0;
+    for(std::uint32_t Q=M; Q>1; Q>>=1){
+        if(X[2] & Q)
+            t ^= Q - 1;
+    }
+    for(int i=0; i<3; i++)
+        X[i] ^= t;
+    return spreadBits(X[2]) | spreadBits(X[1]) << 1 | spreadBits(X[0]) << 2;
+}
+
+CurveEncoder::CurveEncoder(SpaceCurve in_curve, const Eigen::Vector3d& in_lo, double extent) : curve{in_curve}, lo{in_lo},
+    scale{extent > 0.0 ? maxCell/extent : 0.0} {}
+
+std::uint64_t CurveEncoder::key(const Eigen::Vector3d& position) const{
+    std::uint32_t cell[3];
+    for(int d=0; d<3; d++){
+        double c = (position(d) - lo(d))*scale;
+        cell[d] = static_cast<std::uint32_t>(std::min<double>(std::max(c, 0.0), maxCell));
+    }
+    if(curve == SpaceCurve::hilbert)
+        return hilbertKey(cell[0], cell[1], cell[2]);
+    return mortonKey(cell[0], cell[1], cell[2]);
+}
+
+void radixSortByKey(std::vector<std::uint64_t>& keys, std::vector<std::uint32_t>& order, Executor* executor, int threads,
+                    Arena* scratch){
+    const std::size_t n = keys.size();
+    if(n > 0xffffffffu)
+        throw std::invalid_argument("radixSortByKey sorts at most 2^32 keys.");
+    order.resize(n);
+    std::iota(order.begin(), order.end(), 0u);
+    if(n < 2)
+        return;
+
+    // every chunk counts its digits, a prefix sum over (digit, chunk) gives each chunk its slots in the
+    // output, and the chunks scatter in parallel; chunks keep their relative order so the sort is stable
+    const std::size_t radix = 256;
+    const std::size_t minChunk = 4096;
+    std::size_t chunks = std::max<std::size_t>(1, std::min<std::size_t>(4*std::max(threads, 1), n/minChunk));
+    const std::size_t chunkSize = (n + chunks - 1)/chunks;
+    chunks = (n + chunkSize - 1)/chunkSize;
+
+    // passes go back and forth between the inputs and these buffers
+    ArenaAllocator<char> alloc(scratch);
+    std::vector<std::uint64_t, ArenaAllocator<std::uint64_t>> keysBuffer(n, 0, alloc);
+    std::vector<std::uint32_t, ArenaAllocator<std::uint32_t>> orderBuffer(n, 0, alloc);
+    std::vector<std::size_t, ArenaAllocator<std::size_t>> offsets(chunks*radix, 0, alloc);
+    std::uint64_t* keysIn = keys.data();
+    std::uint32_t* orderIn = order.data();
+    std::uint64_t* keysOut = keysBuffer.data();
+    std::uint32_t* orderOut = orderBuffer.data();
+    for(int shift=0; shift<64; shift+=8){
+        forEachChunk(chunks, executor, threads, [&](std::size_t c){
+            std::size_t* count = &offsets[c*radix];
+            std::fill(count, count + radix, 0);
+            const std::size_t end = std::min(n, (c + 1)*chunkSize);
+            for(std::size_t i=c*chunkSize; i<end; i++)
+                count[(keysIn[i] >> shift) & 0xff]++;
+        });
+
+        std::size_t position = 0;
+        bool skip = false;
+        for(std::size_t d=0; d<radix && !skip; d++){
+            std::size_t total = 0;
+            for(std::size_t c=0; c<chunks; c++){
+                std::size_t count = offsets[c*radix + d];
+                offsets[c*radix + d] = position + total;
+                total += count;
+            }
+            // all keys share this digit, the pass would not move anything
+            skip = total == n;
+            position += total;
+        }
+        if(skip)
+            continue;
+
+        forEachChunk(chunks, executor, threads, [&](std::size_t c){
+            std::size_t* next = &offsets[c*radix];
+            const std::size_t end = std::min(n, (c + 1)*chunkSize);
+            for(std::size_t i=c*chunkSize; i<end; i++){
+                std::size_t slot = next[(keysIn[i] >> shift) & 0xff]++;
+                keysOut[slot] = keysIn[i];
+                orderOut[slot] = orderIn[i];
+            }
+        });
+        std::swap(keysIn, keysOut);
+        std::swap(orderIn, orderOut);
+    }
+    // an odd number of passes leaves the result in the buffers
+    if(keysIn != keys.data()){
+        std::copy(keysIn, keysIn + n, keys.data());
+        std::copy(orderIn, orderIn + n, order.data());
+    }
+}
+
+double curveDisorder(const std::vector<std::uint64_t>& keys){
+    if(keys.size() < 2)
+        return 0.0;
+    std::size_t descents = 0;
+    for(std::size_t i=1; i<keys.size(); i++){
+        if(keys[i] < keys[i - 1])
+            descents++;
+    }
+    return descents/double(keys.size() - 1);
+}
@@ -0,0 +1,106 @@
+#include "output.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <unistd.h>
+
+namespace {
+    // longest number to_chars writes at 17 digits: sign, 17 digits, point and a 5 character exponent
+    const std::size_t maxNumber = 24;
+    // the text block of a particle has 7 numbers, an index and about 60 characters of labels, the rows fewer
+    const std::size_t maxRow = 8*maxNumber + 96;
+
+    char* put(char* p, const char* text){
+        std::size_t n = std::strlen(text);
+        std::memcpy(p, text, n);
+        return p + n;
+    }
+
+    char* put(char* p, double value, int precision){
+        return std::to_chars(p, p + maxNumber, value, std::chars_format::general, precision).ptr;
+    }
+
+    char* put(char* p, std::uint64_t value){
+        return std::to_chars(p, p + maxNumber, value).ptr;
+    }
+
+    const double* vectorAt(const nbody_view& view, std::size_t i){
+        return reinterpret_cast<const double*>(static_cast<const char*>(view.data) + i*view.stride);
+    }
+
+    const double& scalarAt(const nbody_view& view, std::size_t i){
+        return *vectorAt(view, i);
+    }
+
+    const std::uint64_t& idAt(const nbody_view& view, std::size_t i){
+        return *reinterpret_cast<const std::uint64_t*>(static_cast<const char*>(view.data) + i*view.stride);
+    }
+}
+
+void formatHeader(const OutputOptions& options, std::string& out){
+    if(options.format == OutputFormat::csv)
+        out += "id,mass,x,y,z,vx,vy,vz\n";
+    else if(options.format == OutputFormat::tsv)
+        out += "id\tmass\tx\ty\tz\tvx\tvy\tvz\n";
+}
+
+void formatRows(const StepState& state, std::size_t begin, std::size_t end, const OutputOptions& options,
+                std::string& out){
+    const int precision = std::clamp(options.precision, 1, 17);
+    // format straight into the string, sized for the longest possible rows and cut back afterwards
+    const std::size_t start = out.size();
+    out.resize(start + (end - begin)*maxRow);
+    char* p = &out[start];
+    for(std::size_t i=begin; i<end; i++){
+        const double* position = vectorAt(state.positions, i);
+        const double* velocity = vectorAt(state.velocities, i);
+        if(options.format == OutputFormat::text){
+            p = put(p, "particle ");
+            p = put(p, std::uint64_t(i));
+            p = put(p, "\nmass: ");
+            p = put(p, scalarAt(state.masses, i), precision);
+            p = put(p, "\nposition: (");
+            for(int k=0; k<3; k++){
+                p = put(p, position[k], precision);
+                *p++ = k < 2 ? ',' : ')';
+            }
+            p = put(p, "\nvelocity: (");
+            for(int k=0; k<3; k++){
+                p = put(p, velocity[k], precision);
+                *p++ = k < 2 ? ',' : ')';
+            }
+            p = put(p, "\n-------------------\n");
+        }else{
+            const char separator = options.format == OutputFormat::csv ? ',' : '\t';
+            p = put(p, idAt(state.ids, i));
+            *p++ = separator;
+            p = put(p, scalarAt(state.masses, i), precision);
+            for(int k=0; k<3; k++){
+                *p++ = separator;
+                p = put(p, position[k], precision);
+            }
+            for(int k=0; k<3; k++){
+                *p++ = separator;
+                p = put(p, velocity[k], precision);
+            }
+            *p++ = '\n';
+        }
+    }
+    out.resize(p - out.data());
+}
+
+bool writeAll(int fd, const char* data, std::size_t size){
+    while(size > 0){
+        ssize_t written = ::write(fd, data, size);
+        if(written < 0){
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
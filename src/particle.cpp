@@ -1,7 +1,21 @@
 #include "particle.hpp"
+#include "trace.hpp"
+#include "fixed.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
-Particle::Particle(double in_mass, Eigen::Vector3d pos, Eigen::Vector3d vel) : mass{in_mass}, velocity{vel}, position{pos} {
+Particle::Particle(double in_mass, Eigen::Vector3d pos, Eigen::Vector3d vel) : id{0}, mass{in_mass}, velocity{vel}, position{pos} {
     if(mass<0 || mass==0){
         std::string errorMessage = "Particle's mass must be >= 0.";
         throw std::invalid_argument(errorMessage);
@@ -26,6 +40,10 @@ const Eigen::Vector3d& Particle::getAcceleration() const {
     return acceleration;
 }
 
+std::uint64_t Particle::getId() const{
+    return id;
+}
+
 void Particle::print() const{
     Eigen::IOFormat CommaInitFmt(3, Eigen::DontAlignCols, ",",",", "", "", "(", ")");
     std::cout << "mass: " << mass << std::endl;
@@ -33,7 +51,7 @@ void Particle::print() const{
     std::cout << "velocity: " << velocity.format(CommaInitFmt) << std::endl; 
 }
 
-void Particle::addAcceleration(Eigen::Vector3d a){
+void Particle::addAcceleration(const Eigen::Vector3d& a){
     acceleration += a;
 }
 
@@ -45,111 +63,946 @@ void Particle::update(double dt){
     acceleration(1) = 0.0;
     acceleration(2) = 0.0;
 }
-pSystem::pSystem(){
-    numParticles=0;
+pSystem::pSystem() : executor{makeExecutor(plan)} {
 }
 
 void pSystem::addParticle(Particle p){
+    compact();
+    p.id = nextId++;
+    slotOf.push_back(particles.size());
     particles.push_back(p);
-    numParticles += 1;
 }
 
-Particle& pSystem::getParticle(int n){
+namespace {
+    // check everything before the store changes, so a bad body leaves the system as it was
+    void checkMasses(std::size_t count, const double* masses){
+        for(std::size_t i=0; i<count; i++){
+            if(!(masses[i] > 0)){
+                std::string errorMessage = "Particle's mass must be > 0, body " + std::to_string(i) + " has " + std::to_string(masses[i]) + ".";
+                throw std::invalid_argument(errorMessage);
+            }
+        }
+    }
+}
+
+void pSystem::addParticles(std::size_t count, const double* masses, const double* positions, const double* velocities){
+    if(count == 0)
+        return;
+    checkMasses(count, masses);
+    insertParticles(count, nullptr, masses, positions, velocities);
+}
+
+void pSystem::addParticles(std::size_t count, const std::uint64_t* ids, const double* masses, const double* positions,
+                           const double* velocities){
+    if(count == 0)
+        return;
+    checkMasses(count, masses);
+    std::uint64_t last = nextId;
+    for(std::size_t i=0; i<count; i++){
+        if(ids[i] < nextId)
+            throw std::invalid_argument("Particle id " + std::to_string(ids[i]) + " has already been given out.");
+        last = std::max(last, ids[i]);
+    }
+    std::vector<bool> taken(last - nextId + 1, false);
+    for(std::size_t i=0; i<count; i++){
+        if(taken[ids[i] - nextId])
+            throw std::invalid_argument("Particle id " + std::to_string(ids[i]) + " appears twice.");
+        taken[ids[i] - nextId] = true;
+    }
+    insertParticles(count, ids, masses, positions, velocities);
+}
+
+void pSystem::insertParticles(std::size_t count, const std::uint64_t* ids, const double* masses, const double* positions,
+                              const double* velocities){
+    // new slots are left untouched by resize(), every thread writes (and first touches) its own share
+    compact();
+    const std::size_t first = particles.size();
+    const std::uint64_t firstId = nextId;
+    if(ids == nullptr){
+        nextId += count;
+    }else{
+        // ids skipped over are never given out, they map to noParticle like deleted ones
+        nextId = *std::max_element(ids, ids + count) + 1;
+    }
+    if(particles.capacity() < first + count)
+        particles.reserve(std::max(first + count, 2*particles.capacity()));
+    particles.resize(first + count);
+    slotOf.resize(nextId, noParticle);
+    auto body = [&](std::size_t b, std::size_t e){
+        for(std::size_t i=b; i<e; i++){
+            Particle& p = particles[first + i];
+            p.id = ids == nullptr ? firstId + i : ids[i];
+            slotOf[p.id] = first + i;
+            p.mass = masses[i];
+            p.position = Eigen::Map<const Eigen::Vector3d>(positions + 3*i);
+            p.velocity = Eigen::Map<const Eigen::Vector3d>(velocities + 3*i);
+            p.acceleration.setZero();
+        }
+    };
+    if(executor){
+        executor->parallelFor(0, count, rowGrain(), body);
+        return;
+    }
+    const long n = count;
+    #pragma omp parallel num_threads(numThreads()) if(plan.parallel)
+    {
+    pinThread();
+    #pragma omp for schedule(static)
+    for(long i=0; i<n; i++){
+        body(i, i + 1);
+    }
+    }
+}
+
+void pSystem::addParticles(const std::vector<double>& masses, const std::vector<Eigen::Vector3d>& positions,
+                           const std::vector<Eigen::Vector3d>& velocities){
+    if(positions.size() != masses.size() || velocities.size() != masses.size())
+        throw std::invalid_argument("addParticles needs as many positions and velocities as masses.");
+    if(masses.empty())
+        return;
+    addParticles(masses.size(), masses.data(), positions.data()->data(), velocities.data()->data());
+}
+
+void pSystem::reserve(std::size_t count){
+    particles.reserve(count);
+}
+
+Particle& pSystem::getParticle(std::size_t n){
     // indexing error is handled internally by vector
-    return particles.at(n);
+    Particle& p = particles.at(n);
+    if(p.mass == 0)
+        throw std::out_of_range("Particle " + std::to_string(n) + " was deleted.");
+    return p;
+}
+
+void pSystem::printParticles(const OutputOptions& options){
+    // whatever is still buffered in std::cout has to come out before the particles
+    std::cout.flush();
+    writeParticles(STDOUT_FILENO, options);
+}
+
+void pSystem::writeParticles(int fd, const OutputOptions& options){
+    TraceScope trace("writeParticles");
+    StepState state = getState();
+    const std::size_t rowsPerChunk = 1024;
+    const std::size_t numChunks = (state.count + rowsPerChunk - 1)/rowsPerChunk;
+    if(outputChunks.size() < numChunks)
+        outputChunks.resize(numChunks);
+    auto body = [&](std::size_t b, std::size_t e){
+        for(std::size_t c=b; c<e; c++){
+            outputChunks[c].clear();
+            formatRows(state, c*rowsPerChunk, std::min(state.count, (c + 1)*rowsPerChunk), options, outputChunks[c]);
+        }
+    };
+    if(executor){
+        executor->parallelFor(0, numChunks, 1, body);
+    }else{
+        const long n = numChunks;
+        #pragma omp parallel for schedule(dynamic) num_threads(numThreads()) if(plan.parallel)
+        for(long c=0; c<n; c++){
+            body(c, c + 1);
+        }
+    }
+
+    outputBuffer.clear();
+    formatHeader(options, outputBuffer);
+    for(std::size_t c=0; c<numChunks; c++)
+        outputBuffer += outputChunks[c];
+    if(!writeAll(fd, outputBuffer.data(), outputBuffer.size()))
+        throw std::runtime_error(std::string("Could not write the particles: ") + std::strerror(errno));
+}
+
+// a deleted particle becomes a tombstone: its mass is set to 0, which no live particle can have, and it
+// stays in its slot until the next compaction, so deleting is O(1) and a batch of deletions is one O(n) pass
+void pSystem::deleteParticle(std::size_t n){
+    if(n >= particles.size() || particles[n].mass == 0)
+        throw std::out_of_range("No particle at index " + std::to_string(n) + ".");
+    particles[n].mass = 0;
+    slotOf[particles[n].id] = noParticle;
+    numDeleted++;
+}
+
+void pSystem::deleteParticleById(std::uint64_t id){
+    deleteParticle(indexOf(id));
 }
 
-void pSystem::printParticles(){
-    for(int i=0; i<numParticles; i++){
-        std::cout << "particle " << i << std::endl;
-        particles.at(i).print();
-        std::cout << "-------------------" << std::endl;
+void pSystem::compact(){
+    if(numDeleted == 0)
+        return;
+    // keeps the order of the survivors, so a curve ordering is not lost, and moves their handles along
+    std::size_t kept = 0;
+    for(std::size_t i=0; i<particles.size(); i++){
+        if(particles[i].mass == 0)
+            continue;
+        if(kept != i)
+            particles[kept] = particles[i];
+        slotOf[particles[kept].id] = kept;
+        kept++;
     }
+    particles.resize(kept);
+    numDeleted = 0;
 }
 
-void pSystem::deleteParticle(int n){
-    // error with index input is handled internally by vector class
-    particles.erase(particles.begin() + n);
-    numParticles -= 1;
+std::size_t pSystem::indexOf(std::uint64_t id) const{
+    if(id >= slotOf.size() || slotOf[id] == noParticle)
+        throw std::out_of_range("No particle with id " + std::to_string(id) + ".");
+    return slotOf[id];
 }
 
-int pSystem::getNumOfParticles(){
-    return numParticles;
+Particle& pSystem::getParticleById(std::uint64_t id){
+    return particles[indexOf(id)];
+}
+
+void pSystem::indicesOf(const std::uint64_t* ids, std::size_t count, std::size_t* slots) const{
+    const std::size_t known = slotOf.size();
+    const std::size_t* table = slotOf.data();
+    const long n = count;
+    // a gather from the table, worth threads only for many ids
+    #pragma omp parallel for num_threads(numThreads()) schedule(static) if(plan.parallel && !executor && count > 100000)
+    for(long i=0; i<n; i++){
+        slots[i] = ids[i] < known ? table[ids[i]] : noParticle;
+    }
+}
+
+std::size_t pSystem::getNumOfParticles(){
+    return particles.size() - numDeleted;
 }
 
 // function calculates the total energy of the system when called (it could also be continuously tracked, but it seems unnecessary
 // as we only want to know the energy at the beginning and end of the simulation)
 std::tuple<double, double> pSystem::getEnergy(){
+    compact();
+    copyArrays();
     double E_kin = 0.0;
     double E_pot = 0.0;
-    double e_kin = 0.0;
-    double e_pot = 0.0;
-    double distance = 0.0;
-
-    #pragma omp parallel for collapse(1) schedule(static) reduction(+:E_kin, E_pot) private(e_kin, e_pot)
-    for(Particle& p : particles){
-
-        // add Particle p's kinetic energy to total energy
-        e_kin = (1.0/2.0 * p.getMass() * std::pow( p.getVelocity().norm(), 2.0 ));         
-        E_kin +=  e_kin;
-
-        for(Particle& k : particles){
-            if(&p != &k){
-                distance = ((p.getPosition()-k.getPosition()).norm());
-                e_pot = (-1.0/2.0 * p.getMass() * k.getMass() / distance );
-                E_pot += e_pot;
+
+    if(executor || plan.deterministic){
+        if(plan.deterministic)
+            prepareForceLoop();
+        // one partial sum per chunk, added up in chunk order; deterministic mode uses fixed chunks and a
+        // fixed summation tree so the result does not depend on the thread count
+        const std::size_t n = particles.size();
+        const std::size_t grain = plan.deterministic ? tileSize : rowGrain();
+        const std::size_t chunks = (n + grain - 1)/grain;
+        scratch.reset();
+        ArenaAllocator<double> alloc(&scratch.local());
+        std::vector<double, ArenaAllocator<double>> kin(chunks, 0.0, alloc);
+        std::vector<double, ArenaAllocator<double>> pot(chunks, 0.0, alloc);
+        auto body = [&](std::size_t b, std::size_t e){
+            TraceScope trace("getEnergy");
+            for(std::size_t c=b; c<e; c++)
+                energyRange(c*grain, std::min(n, (c + 1)*grain), kin[c], pot[c]);
+        };
+        if(executor){
+            executor->parallelFor(0, chunks, 1, body);
+        }else{
+            #pragma omp parallel num_threads(numThreads()) if(plan.parallel)
+            {
+            pinThread();
+            const long numChunks = chunks;
+            #pragma omp for schedule(static) nowait
+            for(long c=0; c<numChunks; c++){
+                body(c, c + 1);
             }
-        }      
+            }
+        }
+        if(plan.deterministic)
+            return std::make_tuple(pairwiseSum(kin.data(), chunks), pairwiseSum(pot.data(), chunks));
+        for(std::size_t c=0; c<chunks; c++){
+            E_kin += kin[c];
+            E_pot += pot[c];
+        }
+        return std::make_tuple(E_kin, E_pot);
+    }
+
+    #pragma omp parallel num_threads(numThreads()) if(plan.parallel) reduction(+:E_kin, E_pot)
+    {
+    pinThread();
+    TraceScope trace("getEnergy");
+    const long n = particles.size();
+    #pragma omp for schedule(static) nowait
+    for(long i=0; i<n; i++){
+        energyRange(i, i + 1, E_kin, E_pot);
+    }
     }
 
     return std::make_tuple(E_kin, E_pot);
 }
 
+void pSystem::energyRange(std::size_t begin, std::size_t end, double& E_kin, double& E_pot){
+    E_kin += kineticEnergy(records(begin), end - begin);
+    // every pair is counted from both sides, so each side adds half of its potential energy
+    const BodyArrays bodies = bodyArrays();
+    for(std::size_t i=begin; i<end; i++){
+        E_pot += -0.5*particles[i].mass*rowPotential(bodies, i, 0, particles.size());
+    }
+}
+
 // acceleration on particle1 due to particle2
 Eigen::Vector3d pSystem::calcAcceleration(const Particle& p1, const Particle& p2, double epsilon){
     if(epsilon<0)
         throw std::invalid_argument("Parameter epsilon must be larger than or equal to zero.");
-    double distance = ((p2.getPosition()-p1.getPosition()).norm());
-    Eigen::Vector3d acc = p2.getMass()*(p2.getPosition()-p1.getPosition())/std::pow((std::pow(distance,2.0)+std::pow(epsilon,2.0)),1.5);
+    Eigen::Vector3d acc;
+    withForceLaw(forceLaw, epsilon, cutoff, [&](const auto& law){
+        acc = pairAcceleration(law, p1.getPosition(), p2.getPosition(), p2.getMass());
+    });
     return acc;
 }
 
+// sums neighbouring pairs level by level, the order only depends on the number of values
+double pSystem::pairwiseSum(double* values, std::size_t n){
+    if(n == 0)
+        return 0.0;
+    for(std::size_t width=1; width<n; width*=2){
+        for(std::size_t i=0; i + width<n; i+=2*width){
+            values[i] += values[i + width];
+        }
+    }
+    return values[0];
+}
+
 void pSystem::updateAccelerations(double epsilon){
+    // exceptions must not escape the parallel region, so check the input before entering it
+    if(epsilon<0)
+        throw std::invalid_argument("Parameter epsilon must be larger than or equal to zero.");
     // first loop can be parallelized, do not need copy of classes since acceleration does not depend on the current value of acceleration
     // and other parameters do not change
+    compact();
+    prepareForceLoop();
+    copyArrays();
+    withForceLaw(forceLaw, epsilon, cutoff, [&](const auto& law){
+        if(executor){
+            executorForces(law);
+            return;
+        }
+        #pragma omp parallel num_threads(numThreads()) if(plan.parallel)
+        {
+        pinThread();
+        forceLoop(law);
+        }
+    });
+}
 
-    #pragma omp parallel for collapse(1) schedule(static) // acceleration in particle class
-    for(Particle& p : particles){
-        for(Particle& k : particles){
-            if(&p != &k)
-                p.addAcceleration(calcAcceleration(p, k, epsilon));
-        }      
+void pSystem::updateVelPos(double dt){
+    compact();
+    copyArrays();
+    if(executor){
+        executorVelPos(Update::euler, dt);
+        return;
+    }
+    #pragma omp parallel num_threads(numThreads()) if(plan.parallel)
+    {
+    pinThread();
+    velPosLoop(Update::euler, dt);
     }
 }
 
-void pSystem::updateVelPos(double dt){
-    #pragma omp parallel for collapse(1) schedule(static)
-    for(Particle& p : particles){
-        p.update(dt);
+// kernels over a range of rows (or of blocks), shared by the OpenMP loops and the executors
+template<class Law>
+void pSystem::accelerationRange(std::size_t begin, std::size_t end, const Law& law){
+    if(plan.deterministic){
+        tiledAccelerationRange(begin, end, law);
+        return;
+    }
+    const BodyArrays bodies = bodyArrays();
+    for(std::size_t i=begin; i<end; i++){
+        Eigen::Vector3d acc;
+        rowAcceleration(bodies, i, 0, particles.size(), law, acc.data());
+        particles[i].addAcceleration(acc);
+    }
+}
+
+// deterministic rows: sums every row in the same j-tiles and the same order as blockRange and reduceRange,
+// so rows and blocks give identical bits and only the tile size matters
+template<class Law>
+void pSystem::tiledAccelerationRange(std::size_t begin, std::size_t end, const Law& law){
+    const std::size_t n = particles.size();
+    const BodyArrays bodies = bodyArrays();
+    for(std::size_t i=begin; i<end; i++){
+        Eigen::Vector3d acc(0.0, 0.0, 0.0);
+        for(std::size_t jt=0; jt<numTiles; jt++){
+            const std::size_t jEnd = std::min(n, (jt + 1)*tileSize);
+            Eigen::Vector3d tileAcc;
+            rowAcceleration(bodies, i, jt*tileSize, jEnd, law, tileAcc.data());
+            if(jt == 0)
+                acc = tileAcc;
+            else
+                acc += tileAcc;
+        }
+        particles[i].addAcceleration(acc);
+    }
+}
+
+// 2D decomposition: the (i-tile, j-tile) blocks are shared out between the threads, so there is enough work
+// for many threads even when there are only a few rows per thread. Each block writes the partial
+// acceleration of its rows due to its columns into its own slot, no two threads write the same memory
+template<class Law>
+void pSystem::blockRange(std::size_t begin, std::size_t end, const Law& law){
+    const std::size_t n = particles.size();
+    const BodyArrays bodies = bodyArrays();
+    for(std::size_t block=begin; block<end; block++){
+        const std::size_t it = block/numTiles;
+        const std::size_t jt = block%numTiles;
+        const std::size_t iEnd = std::min(n, (it + 1)*tileSize);
+        const std::size_t jEnd = std::min(n, (jt + 1)*tileSize);
+        for(std::size_t i=it*tileSize; i<iEnd; i++){
+            rowAcceleration(bodies, i, jt*tileSize, jEnd, law, partialAcc[jt*n + i].data());
+        }
+    }
+}
+
+// sums the partial accelerations of every row in j-tile order, so the result only depends on the tile
+// size and not on the number of threads or which thread computed which block
+void pSystem::reduceRange(std::size_t begin, std::size_t end){
+    const std::size_t n = particles.size();
+    for(std::size_t i=begin; i<end; i++){
+        Eigen::Vector3d acc = partialAcc[i];
+        for(std::size_t jt=1; jt<numTiles; jt++){
+            acc += partialAcc[jt*n + i];
+        }
+        particles[i].addAcceleration(acc);
+    }
+}
+
+// drift-kick-drift leapfrog: half a step of drift before the forces, then the kick with the new forces and
+// the second half of the drift. Inside a run of steps the closing half drift and the opening one of the next
+// step are one full drift, so positions and velocities are only in step again at the end of the run
+void pSystem::velPosRange(std::size_t begin, std::size_t end, Update update, double dt){
+    const double kick = update == Update::drift ? 0.0 : dt;
+    const double drift = update == Update::drift || update == Update::kickHalfDrift ? 0.5*dt : dt;
+    const std::size_t n = particles.size();
+    updateBodies(records(begin), end - begin, update == Update::euler, kick, drift,
+                 arrays.data() + begin, arrays.data() + n + begin, arrays.data() + 2*n + begin);
+}
+
+void pSystem::copyArrays(){
+    const std::size_t n = particles.size();
+    arrays.resize(4*n);
+    for(std::size_t i=0; i<n; i++){
+        arrays[i] = particles[i].position(0);
+        arrays[n + i] = particles[i].position(1);
+        arrays[2*n + i] = particles[i].position(2);
+        arrays[3*n + i] = particles[i].mass;
+    }
+}
+
+BodyArrays pSystem::bodyArrays() const{
+    const std::size_t n = particles.size();
+    return BodyArrays{arrays.data(), arrays.data() + n, arrays.data() + 2*n, arrays.data() + 3*n};
+}
+
+BodyRecords pSystem::records(std::size_t begin){
+    static_assert(sizeof(Particle)%sizeof(double) == 0, "the fields of the particles must be a whole number of doubles apart");
+    Particle& p = particles[begin];
+    return BodyRecords{&p.mass, p.position.data(), p.velocity.data(), p.acceleration.data(), sizeof(Particle)/sizeof(double)};
+}
+
+// the loops below are orphaned worksharing loops: they split their iterations between the threads of
+// the enclosing parallel region (or run serially outside of one). They are nowait, the caller places the
+// barriers, so the trace event of each thread ends when its own share is done
+template<class Law>
+void pSystem::forceLoop(const Law& law){
+    const long n = particles.size();
+    if(plan.decomposition == ForceDecomposition::blocks){
+        {
+        TraceScope trace("forceBlocks");
+        const long blocks = numTiles*numTiles;
+        #pragma omp for schedule(static) nowait
+        for(long block=0; block<blocks; block++){
+            blockRange(block, block + 1, law);
+        }
+        }
+        // all partial sums of a row must be in before the row is reduced
+        #pragma omp barrier
+        TraceScope trace("reduceBlocks");
+        #pragma omp for schedule(static) nowait
+        for(long i=0; i<n; i++){
+            reduceRange(i, i + 1);
+        }
+    }else{
+        TraceScope trace("updateAccelerations");
+        #pragma omp for schedule(static) nowait // acceleration in particle class
+        for(long i=0; i<n; i++){
+            accelerationRange(i, i + 1, law);
+        }
+    }
+}
+
+void pSystem::velPosLoop(Update update, double dt){
+    TraceScope trace(update == Update::drift ? "drift" : "updateVelPos");
+    const long n = particles.size();
+    // same static schedule as the force loop, so every thread updates the particles it computed
+    #pragma omp for schedule(static) nowait
+    for(long i=0; i<n; i++){
+        velPosRange(i, i + 1, update, dt);
+    }
+}
+
+// the same phases on an executor, every parallelFor returns when all its ranges are done
+template<class Law>
+void pSystem::executorForces(const Law& law){
+    const std::size_t n = particles.size();
+    const std::size_t grain = rowGrain();
+    if(plan.decomposition == ForceDecomposition::blocks){
+        executor->parallelFor(0, numTiles*numTiles, 1, [&](std::size_t b, std::size_t e){
+            TraceScope trace("forceBlocks");
+            blockRange(b, e, law);
+        });
+        executor->parallelFor(0, n, grain, [&](std::size_t b, std::size_t e){
+            TraceScope trace("reduceBlocks");
+            reduceRange(b, e);
+        });
+    }else{
+        executor->parallelFor(0, n, grain, [&](std::size_t b, std::size_t e){
+            TraceScope trace("updateAccelerations");
+            accelerationRange(b, e, law);
+        });
+    }
+}
+
+void pSystem::executorVelPos(Update update, double dt){
+    executor->parallelFor(0, particles.size(), rowGrain(), [&](std::size_t b, std::size_t e){
+        TraceScope trace(update == Update::drift ? "drift" : "updateVelPos");
+        velPosRange(b, e, update, dt);
+    });
+}
+
+std::size_t pSystem::rowGrain() const{
+    // about eight chunks per thread, enough for stealing to even out the load
+    return std::max<std::size_t>(1, particles.size()/(8*numThreads()));
+}
+
+void pSystem::prepareForceLoop(){
+    // scratch space can not be allocated inside the parallel region, take it for this run of steps up front
+    if(plan.decomposition != ForceDecomposition::blocks && !plan.deterministic)
+        return;
+    const std::size_t n = particles.size();
+    if(plan.tileSize > 0){
+        tileSize = plan.tileSize;
+    }else if(plan.deterministic){
+        // must not depend on the thread count
+        tileSize = deterministicTileSize;
+    }else{
+        // enough blocks to give every thread about four
+        std::size_t perSide = std::ceil(std::sqrt(4.0*numThreads()));
+        tileSize = std::max<std::size_t>(1, (n + perSide - 1)/perSide);
+    }
+    numTiles = (n + tileSize - 1)/tileSize;
+    // the partials come from the calling thread's arena, untouched until the blocks write them; they are
+    // rewritten every step, so only this run of steps may use the arenas
+    if(plan.decomposition == ForceDecomposition::blocks){
+        scratch.reset();
+        partialAcc = static_cast<Eigen::Vector3d*>(scratch.local().allocate(numTiles*n*sizeof(Eigen::Vector3d), alignof(Eigen::Vector3d)));
     }
 }
 
 void pSystem::evolveSystem(double t, double dt, double epsilon){
-    // both methods are parallelized themselves
-    double t_elapsed = dt;
-    while(t_elapsed<=t){  
+    TraceScope trace("evolveSystem");
+    // exceptions must not escape the parallel region, so check the input before entering it
+    if(epsilon<0)
+        throw std::invalid_argument("Parameter epsilon must be larger than or equal to zero.");
+
+    // count the steps up front with the same accumulation the time loop always used, so every thread
+    // runs the same number of steps and the step count does not change
+    long steps = 0;
+    for(double t_elapsed = dt; t_elapsed<=t; t_elapsed += dt)
+        steps++;
+
+    compact();
+    // without reordering the whole run is one segment, with it the run is cut at every ordering check
+    long done = 0;
+    while(done < steps){
+        // observers and reordering between segments may use the arenas, the scratch is taken again every time
+        prepareForceLoop();
+        long segment = steps - done;
+        if(reorderCurve != SpaceCurve::none)
+            segment = std::min(segment, stepsUntilCheck);
+        long untilObserved = observers.stepsUntilDue(stepCount);
+        if(untilObserved > 0)
+            segment = std::min(segment, untilObserved);
+        runSteps(segment, dt, epsilon);
+        AllocationTracker::countSteps(segment);
+        done += segment;
+        stepCount += segment;
+        simTime += segment*dt;
+        if(segment == untilObserved)
+            notifyObservers();
+        if(reorderCurve != SpaceCurve::none){
+            stepsUntilCheck -= segment;
+            if(stepsUntilCheck <= 0)
+                checkOrdering();
+        }
+    }
+}
+
+void pSystem::notifyObservers(){
+    TraceScope trace("observers");
+    observers.notify(getState());
+}
+
+void pSystem::setIntegrator(Integrator in_integrator){
+    integrator = in_integrator;
+}
+
+Integrator pSystem::getIntegrator() const{
+    return integrator;
+}
+
+void pSystem::setForceLaw(ForceLaw in_forceLaw, double in_cutoff){
+    if(in_forceLaw == ForceLaw::truncated && !(in_cutoff > 0))
+        throw std::invalid_argument("A truncated force law needs a cutoff radius > 0.");
+    forceLaw = in_forceLaw;
+    cutoff = in_cutoff;
+}
+
+ForceLaw pSystem::getForceLaw() const{
+    return forceLaw;
+}
+
+double pSystem::getCutoff() const{
+    return cutoff;
+}
+
+bool pSystem::usesFixedSize() const{
+    return plan.fixedSize && !plan.parallel && !plan.deterministic && !externalExecutor
+           && particles.size() - numDeleted <= static_cast<std::size_t>(maxFixedBodies);
+}
+
+void pSystem::runSteps(long steps, double dt, double epsilon){
+    if(usesFixedSize()){
+        fixedSteps(steps, dt, epsilon);
+        return;
+    }
+    // the law is looked at once per run of steps, every law has its own force loops
+    withForceLaw(forceLaw, epsilon, cutoff, [&](const auto& law){
+        runStepsWith(steps, dt, law);
+    });
+}
+
+template<class Law>
+void pSystem::runStepsWith(long steps, double dt, const Law& law){
+    copyArrays();
+    const bool leapfrog = integrator == Integrator::leapfrog;
+    // what follows the forces of a step: the euler update, or a leapfrog kick and the drift up to the next
+    // force calculation (only half a step after the last one)
+    auto updateAfter = [&](long step){
+        if(!leapfrog)
+            return Update::euler;
+        return step + 1 < steps ? Update::kickDrift : Update::kickHalfDrift;
+    };
+    if(executor){
+        if(leapfrog && steps > 0)
+            executorVelPos(Update::drift, dt);
+        for(long step=0; step<steps; step++){
+            executorForces(law);
+            executorVelPos(updateAfter(step), dt);
+        }
+        return;
+    }
+
+    // one parallel region for the whole run instead of a fork/join per loop per step
+    // positions are updated in place, so two barriers per step are the minimum: forces must be
+    // complete before any particle moves, and every particle must have moved before the next force pass
+    // (the block decomposition adds one more between its blocks and its reduction)
+    #pragma omp parallel num_threads(numThreads()) if(plan.parallel)
+    {
+    pinThread();
+    if(leapfrog && steps > 0){
+        velPosLoop(Update::drift, dt);
+        #pragma omp barrier
+    }
+    for(long step=0; step<steps; step++){
         // function calculates acceleration on all particles
-        updateAccelerations(epsilon);
+        forceLoop(law);
+        #pragma omp barrier
         // function updates velocity and position of particles
+        velPosLoop(updateAfter(step), dt);
         #pragma omp barrier
-        updateVelPos(dt);
-        t_elapsed += dt;
     }
+    }
+}
+
+// small serial systems: the particles are copied into the engine for their size and back after the steps
+void pSystem::fixedSteps(long steps, double dt, double epsilon){
+    TraceScope trace("fixedSteps");
+    const std::size_t n = particles.size();
+    scratch.reset();
+    double* masses = static_cast<double*>(scratch.local().allocate(7*n*sizeof(double), alignof(double)));
+    double* positions = masses + n;
+    double* velocities = positions + 3*n;
+    for(std::size_t i=0; i<n; i++){
+        masses[i] = particles[i].mass;
+        for(int d=0; d<3; d++){
+            positions[3*i + d] = particles[i].position(d);
+            velocities[3*i + d] = particles[i].velocity(d);
+        }
+    }
+    evolveFixed(n, masses, positions, velocities, steps, dt, forceLaw, epsilon, cutoff, integrator);
+    for(std::size_t i=0; i<n; i++){
+        for(int d=0; d<3; d++){
+            particles[i].position(d) = positions[3*i + d];
+            particles[i].velocity(d) = velocities[3*i + d];
+        }
+    }
+}
+
+void pSystem::reorder(SpaceCurve curve){
+    compact();
+    if(curve == SpaceCurve::none || particles.size() < 2)
+        return;
+    TraceScope trace("reorder");
+    computeKeys(curve);
+    sortParticles();
+}
+
+void pSystem::setReordering(SpaceCurve curve, int interval){
+    if(interval < 1)
+        throw std::invalid_argument("Reordering interval must be >= 1.");
+    reorderCurve = curve;
+    reorderStats = ReorderStats();
+    reorderStats.interval = interval;
+    stepsUntilCheck = interval;
+    reorder(curve);
+}
+
+const ReorderStats& pSystem::getReorderStats() const{
+    return reorderStats;
+}
+
+nbody_view pSystem::view(ParticleField field){
+    static_assert(sizeof(Particle) % sizeof(double) == 0, "Views need the particle size to be a whole number of doubles.");
+    compact();
+    nbody_view result{nullptr, particles.size(), sizeof(Particle)};
+    if(particles.empty())
+        return result;
+    const Particle& first = particles[0];
+    if(field == ParticleField::id)
+        result.data = &first.id;
+    else if(field == ParticleField::mass)
+        result.data = &first.mass;
+    else if(field == ParticleField::position)
+        result.data = first.position.data();
+    else
+        result.data = first.velocity.data();
+    return result;
+}
+
+StepState pSystem::getState(){
+    compact();
+    return StepState{stepCount, simTime, particles.size(), view(ParticleField::id), view(ParticleField::mass),
+                     view(ParticleField::position), view(ParticleField::velocity)};
+}
+
+const ArenaGroup& pSystem::getScratch() const{
+    return scratch;
+}
+
+int pSystem::addObserver(const std::string& name, long every, Observer observer, ObserverMode mode){
+    return observers.add(name, every, std::move(observer), mode);
+}
+
+void pSystem::removeObserver(int id){
+    observers.remove(id);
+}
+
+void pSystem::waitForObservers(){
+    observers.wait();
+}
+
+std::vector<ObserverStats> pSystem::getObserverStats() const{
+    return observers.stats();
+}
+
+long pSystem::getStepCount() const{
+    return stepCount;
+}
+
+void pSystem::setClock(long step, double time){
+    if(step < 0)
+        throw std::invalid_argument("Step count must be >= 0.");
+    stepCount = step;
+    simTime = time;
 }
 
-solarSysGenerator::solarSysGenerator(){
+double pSystem::getTime() const{
+    return simTime;
+}
+
+// keys of all particles in the bounding cube of the system
+void pSystem::computeKeys(SpaceCurve curve){
+    const std::size_t n = particles.size();
+    Eigen::Vector3d lo = particles[0].getPosition();
+    Eigen::Vector3d hi = lo;
+    for(const Particle& p : particles){
+        lo = lo.cwiseMin(p.getPosition());
+        hi = hi.cwiseMax(p.getPosition());
+    }
+    const CurveEncoder encoder(curve, lo, (hi - lo).maxCoeff());
+    keys.resize(n);
+    if(executor){
+        executor->parallelFor(0, n, rowGrain(), [&](std::size_t b, std::size_t e){
+            for(std::size_t i=b; i<e; i++)
+                keys[i] = encoder.key(particles[i].getPosition());
+        });
+        return;
+    }
+    const long numKeys = n;
+    #pragma omp parallel for num_threads(numThreads()) schedule(static) if(plan.parallel)
+    for(long i=0; i<numKeys; i++){
+        keys[i] = encoder.key(particles[i].getPosition());
+    }
+}
+
+// sorts the keys and moves every particle to its slot, the copy uses the static partition of the force
+// loop so it keeps first-touch placement
+void pSystem::sortParticles(){
+    scratch.reset();
+    radixSortByKey(keys, order, executor.get(), numThreads(), &scratch.local());
+    sortedParticles.resize(particles.size());
+    if(executor){
+        executor->parallelFor(0, particles.size(), rowGrain(), [&](std::size_t b, std::size_t e){
+            for(std::size_t i=b; i<e; i++){
+                sortedParticles[i] = particles[order[i]];
+                slotOf[sortedParticles[i].id] = i;
+            }
+        });
+    }else{
+        const long n = particles.size();
+        #pragma omp parallel num_threads(numThreads()) if(plan.parallel)
+        {
+        pinThread();
+        #pragma omp for schedule(static)
+        for(long i=0; i<n; i++){
+            sortedParticles[i] = particles[order[i]];
+            slotOf[sortedParticles[i].id] = i;
+        }
+        }
+    }
+    particles.swap(sortedParticles);
+    reorderStats.reorders++;
+}
+
+// measures how far the ordering has decayed since the last sort and adapts the check interval:
+// below a quarter of the threshold the next check can wait twice as long, above twice the threshold
+// the particles move fast enough that it should come twice as soon
+void pSystem::checkOrdering(){
+    const double threshold = 0.1;
+    const long maxInterval = 1024;
+    reorderStats.checks++;
+    if(particles.size() >= 2){
+        TraceScope trace("reorder");
+        computeKeys(reorderCurve);
+        reorderStats.disorder = curveDisorder(keys);
+        if(reorderStats.disorder < threshold/4){
+            reorderStats.interval = std::min(maxInterval, 2*reorderStats.interval);
+        }else{
+            if(reorderStats.disorder > 2*threshold)
+                reorderStats.interval = std::max(1L, reorderStats.interval/2);
+            if(reorderStats.disorder > threshold)
+                sortParticles();
+        }
+    }
+    stepsUntilCheck = reorderStats.interval;
+}
+
+void pSystem::setExecutor(std::shared_ptr<Executor> in_executor){
+    externalExecutor = in_executor != nullptr;
+    executor = std::move(in_executor);
+    if(!externalExecutor)
+        executor = makeExecutor(plan);
+}
+
+const std::shared_ptr<Executor>& pSystem::getExecutor() const{
+    return executor;
+}
+
+const char* pSystem::getBackendName() const{
+    return executor ? executor->name() : "OpenMP";
+}
+
+void pSystem::setExecutionPlan(const ExecutionPlan& in_plan){
+    if(in_plan.threads < 0)
+        throw std::invalid_argument("Thread count of an execution plan must be >= 0.");
+    plan = in_plan;
+    if(!externalExecutor)
+        executor = makeExecutor(plan);
+    if(plan.firstTouch)
+        placeParticles();
+}
+
+const ExecutionPlan& pSystem::getExecutionPlan() const{
+    return plan;
+}
+
+int pSystem::numThreads() const{
+    if(executor)
+        return executor->concurrency();
+    if(!plan.parallel)
+        return 1;
+#ifdef _OPENMP
+    return plan.threads > 0 ? plan.threads : omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+void pSystem::pinThread() const{
+#ifdef _OPENMP
+    if(!plan.cpus.empty())
+        pinCurrentThread(plan.cpus[omp_get_thread_num() % plan.cpus.size()]);
+#endif
+}
+
+// nullptr for the built-in OpenMP backend
+std::shared_ptr<Executor> pSystem::makeExecutor(const ExecutionPlan& plan){
+    if(plan.backend == Backend::serial || (plan.backend == Backend::pool && !plan.parallel))
+        return std::make_shared<SerialExecutor>();
+    if(plan.backend == Backend::pool){
+        int threads = plan.threads > 0 ? plan.threads : std::max(1u, std::thread::hardware_concurrency());
+        return std::make_shared<PoolExecutor>(std::make_shared<WorkStealingPool>(threads));
+    }
+#ifndef _OPENMP
+    // without OpenMP the omp pragmas are ignored, so the OpenMP backend falls back to the pool; systems with
+    // the default thread count share one pool, whose loops take turns, instead of starting threads each
+    if(!plan.parallel)
+        return std::make_shared<SerialExecutor>();
+    if(plan.threads > 0)
+        return std::make_shared<PoolExecutor>(std::make_shared<WorkStealingPool>(plan.threads));
+    static const std::shared_ptr<WorkStealingPool> shared =
+        std::make_shared<WorkStealingPool>(std::max(1u, std::thread::hardware_concurrency()));
+    return std::make_shared<PoolExecutor>(shared);
+#else
+    return nullptr;
+#endif
+}
+
+void pSystem::placeParticles(){
+    compact();
+    // resize() only reserves untouched pages, the copy below writes every page for the first time from
+    // the thread whose static share of the force loop contains it
+    std::vector<Particle, ParticleAllocator<Particle>> placed;
+    placed.resize(particles.size());
+    if(executor){
+        executor->parallelFor(0, particles.size(), rowGrain(), [&](std::size_t b, std::size_t e){
+            std::copy(particles.begin() + b, particles.begin() + e, placed.begin() + b);
+        });
+        particles.swap(placed);
+        return;
+    }
+    #pragma omp parallel num_threads(numThreads()) if(plan.parallel)
+    {
+    pinThread();
+    #pragma omp for schedule(static)
+    for(std::size_t i=0; i<particles.size(); i++){
+        placed[i] = particles[i];
+    }
+    }
+    particles.swap(placed);
+}
+
+solarSysGenerator::solarSysGenerator(unsigned seed){
     // set up random number generator
-    std::mt19937 rng_mt(1);
+    std::mt19937 rng_mt(seed);
     std::uniform_real_distribution<double> distribution(0, 2*M_PI);
     auto dice = std::bind(distribution, rng_mt);
 
@@ -179,9 +1032,9 @@ std::unique_ptr<pSystem> solarSysGenerator::generateInitialConditions(){
     return move(s1);
 }
 
-randomSysGenerator::randomSysGenerator(int n){
+randomSysGenerator::randomSysGenerator(std::size_t n, unsigned seed){
     // set up random number generators
-    std::mt19937 rng_mt(1);
+    std::mt19937 rng_mt(seed);
     // theta distribution
     std::uniform_real_distribution<double> distTheta(0.0, 2*M_PI);
     // distance distribution
@@ -189,17 +1042,23 @@ randomSysGenerator::randomSysGenerator(int n){
     // mass distribution
     std::uniform_real_distribution<double> distM(1.0/6000000.0, 1.0/1000.0);
 
-    auto dice = std::bind(distTheta, rng_mt);
-
     double theta = 0.0;
     double r = 0.0;
     double m = 0.0;
 
+    // draw all bodies first and add them in one go
+    const std::size_t count = std::max<std::size_t>(n, 1);
+    std::vector<double> masses(count);
+    std::vector<Eigen::Vector3d> positions(count);
+    std::vector<Eigen::Vector3d> velocities(count);
+
     // add central star
-    s1->addParticle(Particle(1.0, Eigen::Vector3d(0.0, 0.0, 0.0), Eigen::Vector3d(0.0, 0.0, 0.0)));
+    masses[0] = 1.0;
+    positions[0] = Eigen::Vector3d(0.0, 0.0, 0.0);
+    velocities[0] = Eigen::Vector3d(0.0, 0.0, 0.0);
 
     // add other planets with random initial conditions
-    for(int i=1; i<n; i++){
+    for(std::size_t i=1; i<count; i++){
 
         theta = distTheta(rng_mt);
         r = distR(rng_mt);
@@ -210,14 +1069,83 @@ randomSysGenerator::randomSysGenerator(int n){
         double v_x = -1/std::pow(r,0.5)*std::cos(theta);
         double v_y = 1/std::pow(r,0.5)*std::sin(theta);
 
-        s1->addParticle(Particle(m, Eigen::Vector3d(r_x, r_y, 0.0), Eigen::Vector3d(v_x, v_y, 0.0)));
+        masses[i] = m;
+        positions[i] = Eigen::Vector3d(r_x, r_y, 0.0);
+        velocities[i] = Eigen::Vector3d(v_x, v_y, 0.0);
     }
+    s1->addParticles(masses, positions, velocities);
 }
 
 std::unique_ptr<pSystem> randomSysGenerator::generateInitialConditions(){
     return move(s1);
 }
 
+fileSysGenerator::fileSysGenerator(const std::string& filename){
+    std::ifstream file(filename);
+    if(!file)
+        throw std::invalid_argument("Can not read particles from " + filename + ".");
+    std::string line;
+    std::getline(file, line);
+    int lineNumber = 1;
+    // a checkpoint starts with the step and time it was written at
+    long step = 0;
+    double time = 0.0;
+    if(line.rfind("#", 0) == 0){
+        if(std::sscanf(line.c_str(), "# step %ld time %lf", &step, &time) != 2 || step < 0)
+            throw std::invalid_argument(filename + ":1: expected \"# step <steps> time <time>\".");
+        std::getline(file, line);
+        lineNumber++;
+    }
+    const char separator = line.find('\t') != std::string::npos ? '\t' : ',';
+    if(line.rfind(separator == ',' ? "id,mass," : "id\tmass\t", 0) != 0)
+        throw std::invalid_argument(filename + ":" + std::to_string(lineNumber) + ": expected the header of a particle file (id, mass, x, y, z, vx, vy, vz).");
+
+    std::vector<std::uint64_t> ids;
+    std::vector<double> masses;
+    std::vector<double> positions;
+    std::vector<double> velocities;
+    while(std::getline(file, line)){
+        lineNumber++;
+        if(line.empty())
+            continue;
+        double values[8];
+        const char* p = line.c_str();
+        char* end = nullptr;
+        int column = 0;
+        for(; column<8; column++){
+            values[column] = std::strtod(p, &end);
+            if(end == p)
+                break;
+            p = end;
+            if(column < 7){
+                if(*p != separator)
+                    break;
+                p++;
+            }
+        }
+        if(column < 8 || *p != '\0')
+            throw std::invalid_argument(filename + ":" + std::to_string(lineNumber) + ": expected 8 numbers.");
+        // ids are whole numbers that a double holds exactly
+        if(!(values[0] >= 0 && values[0] < 9007199254740992.0) || values[0] != std::floor(values[0]))
+            throw std::invalid_argument(filename + ":" + std::to_string(lineNumber) + ": the id must be a whole number >= 0.");
+        ids.push_back(static_cast<std::uint64_t>(values[0]));
+        masses.push_back(values[1]);
+        positions.insert(positions.end(), values + 2, values + 5);
+        velocities.insert(velocities.end(), values + 5, values + 8);
+    }
+    // the bodies keep their ids, so a restarted run goes on with the same handles
+    try{
+        s1->addParticles(ids.size(), ids.data(), masses.data(), positions.data(), velocities.data());
+        s1->setClock(step, time);
+    } catch(const std::invalid_argument& e){
+        throw std::invalid_argument(filename + ": " + e.what());
+    }
+}
+
+std::unique_ptr<pSystem> fileSysGenerator::generateInitialConditions(){
+    return move(s1);
+}
+
 void Timer::reset(){
     curr = Clock::now();
 }
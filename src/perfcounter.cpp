@@ -0,0 +1,97 @@
+#include "perfcounter.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cstdlib>
+#include <cstring>
+#endif
+
+PerfCounter::PerfCounter(Event event, Scope scope){
+#ifdef __linux__
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    const std::uint64_t result = event == Event::dtlbLoadMisses ? PERF_COUNT_HW_CACHE_RESULT_MISS : PERF_COUNT_HW_CACHE_RESULT_ACCESS;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    if(scope == Scope::thread){
+        int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if(fd >= 0)
+            fds.push_back(fd);
+        return;
+    }
+    // every thread of the process is a directory in /proc/self/task named by its tid
+    attr.inherit = 1;
+    DIR* tasks = opendir("/proc/self/task");
+    if(tasks == nullptr)
+        return;
+    while(dirent* entry = readdir(tasks)){
+        if(entry->d_name[0] == '.')
+            continue;
+        const pid_t tid = static_cast<pid_t>(std::atoi(entry->d_name));
+        int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0));
+        if(fd < 0){
+            // a counter that misses some threads would under-report, all or nothing
+            for(int open : fds)
+                close(open);
+            fds.clear();
+            break;
+        }
+        fds.push_back(fd);
+    }
+    closedir(tasks);
+#else
+    (void)event;
+    (void)scope;
+#endif
+}
+
+PerfCounter::~PerfCounter(){
+#ifdef __linux__
+    for(int fd : fds)
+        close(fd);
+#endif
+}
+
+bool PerfCounter::available() const{
+    return !fds.empty();
+}
+
+void PerfCounter::start(){
+#ifdef __linux__
+    for(int fd : fds){
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+void PerfCounter::stop(){
+#ifdef __linux__
+    for(int fd : fds)
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+std::uint64_t PerfCounter::read() const{
+    std::uint64_t total = 0;
+#ifdef __linux__
+    for(int fd : fds){
+        std::uint64_t count = 0;
+        if(::read(fd, &count, sizeof(count)) == sizeof(count))
+            total += count;
+    }
+#endif
+    return total;
+}
+
+int PerfCounter::threads() const{
+    return static_cast<int>(fds.size());
+}
@@ -0,0 +1,373 @@
+#include "planner.hpp"
+#include "particle.hpp"
+#include "executor.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <utility>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace {
+    // reads a single integer from a sysfs file, -1 if it is not there
+    int readSysInt(const std::string& path){
+        std::ifstream file(path);
+        int value = -1;
+        if(!(file >> value))
+            return -1;
+        return value;
+    }
+
+    // fraction of a core an SMT sibling adds to a compute bound force loop
+    const double smtYield = 0.15;
+}
+
+int CpuTopology::numLogical() const{
+    return static_cast<int>(cpus.size());
+}
+
+bool CpuTopology::hasSMT() const{
+    return numLogical() > numCores;
+}
+
+std::vector<int> CpuTopology::placement(ThreadPinning pinning, int threads) const{
+    std::vector<int> result;
+    if(pinning == ThreadPinning::none || cpus.empty() || threads <= 0)
+        return result;
+
+    // rank of every cpu among the SMT siblings of its core, 0 for the first one
+    std::vector<Cpu> ordered = cpus;
+    std::vector<int> sibling(ordered.size(), 0);
+    std::sort(ordered.begin(), ordered.end(), [](const Cpu& a, const Cpu& b){
+        return std::make_tuple(a.socket, a.core, a.id) < std::make_tuple(b.socket, b.core, b.id);
+    });
+    for(std::size_t i=1; i<ordered.size(); i++){
+        if(ordered[i].socket == ordered[i-1].socket && ordered[i].core == ordered[i-1].core)
+            sibling[i] = sibling[i-1] + 1;
+    }
+
+    // per socket list of cpus, physical cores first
+    std::vector<std::vector<int>> perSocket;
+    std::vector<int> socketIds;
+    int maxSibling = *std::max_element(sibling.begin(), sibling.end());
+    for(int rank=0; rank<=maxSibling; rank++){
+        for(std::size_t i=0; i<ordered.size(); i++){
+            if(sibling[i] != rank)
+                continue;
+            auto it = std::find(socketIds.begin(), socketIds.end(), ordered[i].socket);
+            if(it == socketIds.end()){
+                socketIds.push_back(ordered[i].socket);
+                perSocket.emplace_back();
+                it = socketIds.end() - 1;
+            }
+            perSocket[it - socketIds.begin()].push_back(ordered[i].id);
+        }
+    }
+
+    std::vector<int> order;
+    if(pinning == ThreadPinning::compact){
+        // physical cores of every socket in turn, then the siblings
+        for(int rank=0; rank<=maxSibling; rank++){
+            for(std::size_t i=0; i<ordered.size(); i++){
+                if(sibling[i] == rank)
+                    order.push_back(ordered[i].id);
+            }
+        }
+    }else{
+        std::size_t longest = 0;
+        for(auto& socket : perSocket)
+            longest = std::max(longest, socket.size());
+        for(std::size_t k=0; k<longest; k++){
+            for(auto& socket : perSocket){
+                if(k < socket.size())
+                    order.push_back(socket[k]);
+            }
+        }
+    }
+
+    // more threads than cpus wrap around
+    for(int t=0; t<threads; t++)
+        result.push_back(order[t % order.size()]);
+    return result;
+}
+
+void pinCurrentThread(int cpu){
+    thread_local int pinnedTo = -1;
+    if(cpu == pinnedTo)
+        return;
+#ifdef __linux__
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    if(sched_setaffinity(0, sizeof(mask), &mask) == 0)
+        pinnedTo = cpu;
+#endif
+}
+
+CpuTopology CpuTopology::detect(){
+    CpuTopology topology;
+    std::set<std::pair<int, int>> cores;
+    std::set<int> sockets;
+
+#ifdef __linux__
+    // only the cpus we are allowed to run on count, containers and taskset restrict this
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if(sched_getaffinity(0, sizeof(mask), &mask) == 0){
+        for(int id=0; id<CPU_SETSIZE; id++){
+            if(!CPU_ISSET(id, &mask))
+                continue;
+            std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/topology/";
+            int core = readSysInt(base + "core_id");
+            int socket = readSysInt(base + "physical_package_id");
+            // without topology information every cpu is its own core
+            if(core < 0)
+                core = id;
+            if(socket < 0)
+                socket = 0;
+            topology.cpus.push_back(CpuTopology::Cpu{id, core, socket});
+            cores.insert({socket, core});
+            sockets.insert(socket);
+        }
+    }
+#endif
+
+    if(topology.cpus.empty()){
+        int n = std::max(1u, std::thread::hardware_concurrency());
+        for(int id=0; id<n; id++){
+            topology.cpus.push_back(CpuTopology::Cpu{id, id, 0});
+            cores.insert({0, id});
+        }
+        sockets.insert(0);
+    }
+
+    topology.numCores = static_cast<int>(cores.size());
+    topology.numSockets = static_cast<int>(sockets.size());
+    return topology;
+}
+
+std::string ExecutionPlan::describe() const{
+    std::stringstream s;
+    if(backend == Backend::pool)
+        s << "work-stealing pool, ";
+    else if(backend == Backend::serial)
+        s << "serial backend, ";
+    if(parallel){
+        s << "parallel, ";
+        if(threads > 0)
+            s << threads << " threads";
+        else
+            s << "default thread count";
+        s << ", SMT " << (useSMT ? "on" : "off");
+        if(decomposition == ForceDecomposition::blocks){
+            s << ", 2D blocks";
+            if(tileSize > 0)
+                s << " of " << tileSize;
+        }
+    }else{
+        s << "serial";
+    }
+    if(pinning != ThreadPinning::none){
+        s << ", pinned " << (pinning == ThreadPinning::compact ? "compact" : "scatter") << " to cpus";
+        for(std::size_t i=0; i<cpus.size(); i++)
+            s << (i == 0 ? " " : ",") << cpus[i];
+    }
+    if(firstTouch)
+        s << ", first-touch placement";
+    if(deterministic)
+        s << ", deterministic (tiles of " << (tileSize > 0 ? tileSize : deterministicTileSize) << ")";
+    else if(fixedSize && !parallel)
+        s << ", fixed-size engine for small systems";
+    s << " (" << reason << ")";
+    return s.str();
+}
+
+ExecutionPlanner::ExecutionPlanner(CpuTopology in_topology) : topology{std::move(in_topology)},
+    backend{openMPAvailable() ? Backend::openmp : Backend::pool} {}
+
+void ExecutionPlanner::setThreads(int n){
+    userThreads = n;
+}
+
+void ExecutionPlanner::setSMT(bool allow){
+    userSMT = allow;
+}
+
+void ExecutionPlanner::setPinning(ThreadPinning in_pinning){
+    pinning = in_pinning;
+}
+
+void ExecutionPlanner::setFirstTouch(bool enable){
+    firstTouch = enable;
+}
+
+void ExecutionPlanner::setDecomposition(ForceDecomposition in_decomposition){
+    userDecomposition = in_decomposition == ForceDecomposition::blocks ? 1 : 0;
+}
+
+void ExecutionPlanner::setTileSize(int size){
+    tileSize = std::max(0, size);
+}
+
+void ExecutionPlanner::setBackend(Backend in_backend){
+    backend = in_backend;
+}
+
+void ExecutionPlanner::setDeterministic(bool enable){
+    deterministic = enable;
+}
+
+void ExecutionPlanner::setFixedSize(bool enable){
+    fixedSize = enable;
+}
+
+void ExecutionPlanner::setCalibration(double in_pairCost, std::vector<double> in_syncCost){
+    pairCost = in_pairCost;
+    syncCost = std::move(in_syncCost);
+    calibrated = true;
+}
+
+const CpuTopology& ExecutionPlanner::getTopology() const{
+    return topology;
+}
+
+double ExecutionPlanner::getPairCost() const{
+    return pairCost;
+}
+
+void ExecutionPlanner::calibrate(){
+    // cost of one pair interaction, measured serially on a small system
+    const int probeSize = 64;
+    const int probeReps = 20;
+    pSystem probe;
+    for(int i=0; i<probeSize; i++){
+        probe.addParticle(Particle(1.0, Eigen::Vector3d(i, 0.5*i, 0.0), Eigen::Vector3d(0.0, 0.0, 0.0)));
+    }
+    ExecutionPlan serial;
+    serial.parallel = false;
+    probe.setExecutionPlan(serial);
+    probe.updateAccelerations(0.0);
+    Timer timer;
+    for(int r=0; r<probeReps; r++){
+        probe.updateAccelerations(0.0);
+    }
+    pairCost = timer.elapsed()/(probeReps*probeSize*(probeSize - 1.0));
+
+    // synchronisation cost of one step (two barriers) for every thread count we might use
+    const int syncReps = 100;
+    int maxThreads = topology.numLogical();
+    syncCost.assign(maxThreads + 1, 0.0);
+    if(backend == Backend::serial)
+        return;
+    if(backend == Backend::pool || !openMPAvailable()){
+        // two loops per step on the pool, measured once on all threads and used for every thread count
+        if(maxThreads < 2)
+            return;
+        WorkStealingPool pool(maxThreads);
+        auto empty = [](std::size_t, std::size_t, int){};
+        pool.parallelFor(0, maxThreads, 1, empty);
+        timer.reset();
+        for(int r=0; r<syncReps; r++){
+            pool.parallelFor(0, maxThreads, 1, empty);
+            pool.parallelFor(0, maxThreads, 1, empty);
+        }
+        double cost = timer.elapsed()/syncReps;
+        for(int p=2; p<=maxThreads; p++)
+            syncCost[p] = cost;
+        return;
+    }
+    for(int p=2; p<=maxThreads; p++){
+        // the first region pays for starting the threads, leave it out of the measurement
+        #pragma omp parallel num_threads(p)
+        {
+            #pragma omp barrier
+        }
+        timer.reset();
+        #pragma omp parallel num_threads(p)
+        for(int r=0; r<syncReps; r++){
+            #pragma omp barrier
+            #pragma omp barrier
+        }
+        syncCost[p] = timer.elapsed()/syncReps;
+    }
+}
+
+ExecutionPlan ExecutionPlanner::plan(std::size_t n){
+    ExecutionPlan result;
+
+    // explicit thread count wins, no need to probe
+    if(userThreads > 0){
+        result.parallel = userThreads > 1;
+        result.threads = userThreads;
+        result.useSMT = userSMT || userThreads > topology.numCores;
+        result.decomposition = userDecomposition == 1 ? ForceDecomposition::blocks : ForceDecomposition::rows;
+        result.reason = "user override";
+        applyUserOptions(result);
+        return result;
+    }
+
+    if(!calibrated){
+        calibrate();
+        calibrated = true;
+    }
+
+    // time of one step on p threads: the busiest thread does ceil(n/p) rows of n-1 pairs, threads
+    // beyond the physical cores only add a fraction of a core and are only tried when SMT is allowed
+    int maxThreads = userSMT ? topology.numLogical() : topology.numCores;
+    maxThreads = std::min<int>(maxThreads, static_cast<int>(syncCost.size()) - 1);
+    maxThreads = std::max(maxThreads, 1);
+
+    // blocks share the n^2 pairs out evenly but pay for a third barrier, rows leave threads idle when
+    // n is not a multiple of p
+    double rowCost = pairCost*(n > 0 ? n - 1.0 : 0.0);
+    int best = 1;
+    bool bestBlocks = false;
+    double bestTime = rowCost*n;
+    double serialTime = bestTime;
+    for(int p=2; p<=maxThreads; p++){
+        double speed = std::min(p, topology.numCores) + smtYield*std::max(0, p - topology.numCores);
+        double rowsTime = rowCost*std::ceil(n/double(p))*p/speed + syncCost[p];
+        double blocksTime = rowCost*n/speed + 1.5*syncCost[p];
+        bool blocks = userDecomposition == 1 || (userDecomposition == -1 && blocksTime < rowsTime);
+        double time = blocks ? blocksTime : rowsTime;
+        if(time < bestTime){
+            best = p;
+            bestBlocks = blocks;
+            bestTime = time;
+        }
+    }
+
+    result.parallel = best > 1;
+    result.threads = best;
+    result.useSMT = best > topology.numCores;
+    result.decomposition = bestBlocks ? ForceDecomposition::blocks : ForceDecomposition::rows;
+    std::stringstream reason;
+    reason << "n=" << n << ", " << topology.numCores << " cores/" << topology.numLogical() << " cpus, modelled step "
+           << serialTime*1e6 << "us serial";
+    if(best > 1)
+        reason << " vs " << bestTime*1e6 << "us on " << best << " threads";
+    result.reason = reason.str();
+    applyUserOptions(result);
+    return result;
+}
+
+void ExecutionPlanner::applyUserOptions(ExecutionPlan& result) const{
+    result.backend = backend;
+    // the serial backend runs on one thread whatever the model says
+    if(backend == Backend::serial){
+        result.parallel = false;
+        result.threads = 1;
+    }
+    result.tileSize = tileSize;
+    result.pinning = pinning;
+    result.cpus = topology.placement(pinning, result.threads);
+    result.firstTouch = firstTouch;
+    result.deterministic = deterministic;
+    result.fixedSize = fixedSize;
+}
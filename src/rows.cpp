@@ -0,0 +1,240 @@
+#include "rows.hpp"
+#include "forcelaw.hpp"
+#include "isa.hpp"
+
+#include <cmath>
+
+namespace {
+    // adds up the lanes of a row in the same tree at every level
+    NBODY_KERNEL double sumLanes(const double* lanes){
+        return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    }
+
+    // i is masked rather than skipped, so a body keeps its lane wherever i falls in the range; its term is
+    // computed with the others (inf without softening) and thrown away, so the loads need no mask
+    template<class Law>
+    NBODY_KERNEL void rowForces(const BodyArrays& b, std::size_t i, std::size_t begin, std::size_t end, const Law& law,
+                                double* acc){
+        const double xi = b.x[i];
+        const double yi = b.y[i];
+        const double zi = b.z[i];
+        alignas(64) double ax[rowLanes] = {};
+        alignas(64) double ay[rowLanes] = {};
+        alignas(64) double az[rowLanes] = {};
+        std::size_t j = begin;
+        for(; j + rowLanes<=end; j += rowLanes){
+            #pragma omp simd
+            for(std::size_t l=0; l<rowLanes; l++){
+                const double dx = b.x[j + l] - xi;
+                const double dy = b.y[j + l] - yi;
+                const double dz = b.z[j + l] - zi;
+                const double scaled = b.m[j + l]*law.scale(dx*dx + dy*dy + dz*dz);
+                const double s = j + l == i ? 0.0 : scaled;
+                ax[l] += s*dx;
+                ay[l] += s*dy;
+                az[l] += s*dz;
+            }
+        }
+        for(std::size_t l=0; j<end; j++, l++){
+            const double dx = b.x[j] - xi;
+            const double dy = b.y[j] - yi;
+            const double dz = b.z[j] - zi;
+            const double scaled = b.m[j]*law.scale(dx*dx + dy*dy + dz*dz);
+            const double s = j == i ? 0.0 : scaled;
+            ax[l] += s*dx;
+            ay[l] += s*dy;
+            az[l] += s*dz;
+        }
+        acc[0] = sumLanes(ax);
+        acc[1] = sumLanes(ay);
+        acc[2] = sumLanes(az);
+    }
+
+    NBODY_KERNEL double rowPotentialSum(const BodyArrays& b, std::size_t i, std::size_t begin, std::size_t end){
+        const double xi = b.x[i];
+        const double yi = b.y[i];
+        const double zi = b.z[i];
+        alignas(64) double pot[rowLanes] = {};
+        std::size_t j = begin;
+        for(; j + rowLanes<=end; j += rowLanes){
+            #pragma omp simd
+            for(std::size_t l=0; l<rowLanes; l++){
+                const double dx = b.x[j + l] - xi;
+                const double dy = b.y[j + l] - yi;
+                const double dz = b.z[j + l] - zi;
+                const double potential = b.m[j + l]/std::sqrt(dx*dx + dy*dy + dz*dz);
+                pot[l] += j + l == i ? 0.0 : potential;
+            }
+        }
+        for(std::size_t l=0; j<end; j++, l++){
+            const double dx = b.x[j] - xi;
+            const double dy = b.y[j] - yi;
+            const double dz = b.z[j] - zi;
+            const double potential = b.m[j]/std::sqrt(dx*dx + dy*dy + dz*dz);
+            pot[l] += j == i ? 0.0 : potential;
+        }
+        return sumLanes(pot);
+    }
+
+    // every particle is updated on its own, the strided loads are gathers where the level has them
+    NBODY_KERNEL void updateRecords(const BodyRecords& r, std::size_t count, bool euler, double kick, double drift,
+                                    double* x, double* y, double* z){
+        const std::size_t s = r.stride;
+        if(euler){
+            #pragma omp simd
+            for(std::size_t k=0; k<count; k++){
+                double* p = r.position + k*s;
+                double* v = r.velocity + k*s;
+                double* a = r.acceleration + k*s;
+                for(int d=0; d<3; d++){
+                    p[d] += v[d]*drift;
+                    v[d] += a[d]*kick;
+                    a[d] = 0.0;
+                }
+                x[k] = p[0];
+                y[k] = p[1];
+                z[k] = p[2];
+            }
+        }else if(kick == 0.0){
+            #pragma omp simd
+            for(std::size_t k=0; k<count; k++){
+                double* p = r.position + k*s;
+                const double* v = r.velocity + k*s;
+                for(int d=0; d<3; d++){
+                    p[d] += drift*v[d];
+                }
+                x[k] = p[0];
+                y[k] = p[1];
+                z[k] = p[2];
+            }
+        }else{
+            #pragma omp simd
+            for(std::size_t k=0; k<count; k++){
+                double* p = r.position + k*s;
+                double* v = r.velocity + k*s;
+                double* a = r.acceleration + k*s;
+                for(int d=0; d<3; d++){
+                    v[d] += kick*a[d];
+                    p[d] += drift*v[d];
+                    a[d] = 0.0;
+                }
+                x[k] = p[0];
+                y[k] = p[1];
+                z[k] = p[2];
+            }
+        }
+    }
+
+    NBODY_KERNEL double kineticSum(const BodyRecords& r, std::size_t count){
+        const std::size_t s = r.stride;
+        alignas(64) double kin[rowLanes] = {};
+        std::size_t k = 0;
+        for(; k + rowLanes<=count; k += rowLanes){
+            #pragma omp simd
+            for(std::size_t l=0; l<rowLanes; l++){
+                const double* v = r.velocity + (k + l)*s;
+                kin[l] += 0.5*r.mass[(k + l)*s]*(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+            }
+        }
+        for(std::size_t l=0; k<count; k++, l++){
+            const double* v = r.velocity + k*s;
+            kin[l] += 0.5*r.mass[k*s]*(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+        }
+        return sumLanes(kin);
+    }
+
+    // one version of the kernels per instruction set, see isa.hpp
+    template<class Law>
+    using ForcesKernel = void (*)(const BodyArrays&, std::size_t, std::size_t, std::size_t, const Law&, double*);
+    using PotentialKernel = double (*)(const BodyArrays&, std::size_t, std::size_t, std::size_t);
+    using UpdateKernel = void (*)(const BodyRecords&, std::size_t, bool, double, double, double*, double*, double*);
+    using KineticKernel = double (*)(const BodyRecords&, std::size_t);
+
+    template<class Law>
+    void forcesSse2(const BodyArrays& b, std::size_t i, std::size_t begin, std::size_t end, const Law& law, double* acc){
+        rowForces(b, i, begin, end, law, acc);
+    }
+    template<class Law>
+    NBODY_TARGET_SSE42 void forcesSse42(const BodyArrays& b, std::size_t i, std::size_t begin, std::size_t end,
+                                        const Law& law, double* acc){
+        rowForces(b, i, begin, end, law, acc);
+    }
+    template<class Law>
+    NBODY_TARGET_AVX2 void forcesAvx2(const BodyArrays& b, std::size_t i, std::size_t begin, std::size_t end,
+                                      const Law& law, double* acc){
+        rowForces(b, i, begin, end, law, acc);
+    }
+    template<class Law>
+    NBODY_TARGET_AVX512 void forcesAvx512(const BodyArrays& b, std::size_t i, std::size_t begin, std::size_t end,
+                                          const Law& law, double* acc){
+        rowForces(b, i, begin, end, law, acc);
+    }
+
+    double potentialSse2(const BodyArrays& b, std::size_t i, std::size_t begin, std::size_t end){
+        return rowPotentialSum(b, i, begin, end);
+    }
+    NBODY_TARGET_SSE42 double potentialSse42(const BodyArrays& b, std::size_t i, std::size_t begin, std::size_t end){
+        return rowPotentialSum(b, i, begin, end);
+    }
+    NBODY_TARGET_AVX2 double potentialAvx2(const BodyArrays& b, std::size_t i, std::size_t begin, std::size_t end){
+        return rowPotentialSum(b, i, begin, end);
+    }
+    NBODY_TARGET_AVX512 double potentialAvx512(const BodyArrays& b, std::size_t i, std::size_t begin, std::size_t end){
+        return rowPotentialSum(b, i, begin, end);
+    }
+
+    void updateSse2(const BodyRecords& r, std::size_t count, bool euler, double kick, double drift,
+                    double* x, double* y, double* z){
+        updateRecords(r, count, euler, kick, drift, x, y, z);
+    }
+    NBODY_TARGET_SSE42 void updateSse42(const BodyRecords& r, std::size_t count, bool euler, double kick, double drift,
+                                        double* x, double* y, double* z){
+        updateRecords(r, count, euler, kick, drift, x, y, z);
+    }
+    NBODY_TARGET_AVX2 void updateAvx2(const BodyRecords& r, std::size_t count, bool euler, double kick, double drift,
+                                      double* x, double* y, double* z){
+        updateRecords(r, count, euler, kick, drift, x, y, z);
+    }
+    NBODY_TARGET_AVX512 void updateAvx512(const BodyRecords& r, std::size_t count, bool euler, double kick, double drift,
+                                          double* x, double* y, double* z){
+        updateRecords(r, count, euler, kick, drift, x, y, z);
+    }
+
+    double kineticSse2(const BodyRecords& r, std::size_t count){
+        return kineticSum(r, count);
+    }
+    NBODY_TARGET_SSE42 double kineticSse42(const BodyRecords& r, std::size_t count){
+        return kineticSum(r, count);
+    }
+    NBODY_TARGET_AVX2 double kineticAvx2(const BodyRecords& r, std::size_t count){
+        return kineticSum(r, count);
+    }
+    NBODY_TARGET_AVX512 double kineticAvx512(const BodyRecords& r, std::size_t count){
+        return kineticSum(r, count);
+    }
+}
+
+template<class Law>
+void rowAcceleration(const BodyArrays& bodies, std::size_t i, std::size_t begin, std::size_t end, const Law& law,
+                     double* acc){
+    forVectorIsa<ForcesKernel<Law>>(forcesSse2<Law>, forcesSse42<Law>, forcesAvx2<Law>, forcesAvx512<Law>)(
+        bodies, i, begin, end, law, acc);
+}
+
+template void rowAcceleration(const BodyArrays&, std::size_t, std::size_t, std::size_t, const UnsoftenedLaw&, double*);
+template void rowAcceleration(const BodyArrays&, std::size_t, std::size_t, std::size_t, const PlummerLaw&, double*);
+template void rowAcceleration(const BodyArrays&, std::size_t, std::size_t, std::size_t, const SplineLaw&, double*);
+template void rowAcceleration(const BodyArrays&, std::size_t, std::size_t, std::size_t, const TruncatedLaw&, double*);
+
+double rowPotential(const BodyArrays& bodies, std::size_t i, std::size_t begin, std::size_t end){
+    return forVectorIsa<PotentialKernel>(potentialSse2, potentialSse42, potentialAvx2, potentialAvx512)(bodies, i, begin, end);
+}
+
+void updateBodies(const BodyRecords& records, std::size_t count, bool euler, double kick, double drift,
+                  double* x, double* y, double* z){
+    forVectorIsa<UpdateKernel>(updateSse2, updateSse42, updateAvx2, updateAvx512)(records, count, euler, kick, drift, x, y, z);
+}
+
+double kineticEnergy(const BodyRecords& records, std::size_t count){
+    return forVectorIsa<KineticKernel>(kineticSse2, kineticSse42, kineticAvx2, kineticAvx512)(records, count);
+}
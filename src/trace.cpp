@@ -0,0 +1,175 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+struct Tracer::ThreadBuffer {
+    int tid;
+    std::vector<Event> events;
+    // only the owning thread writes count and dropped, the writer reads them after the run
+    std::atomic<std::size_t> count{0};
+    std::atomic<std::size_t> dropped{0};
+};
+
+std::atomic<bool> Tracer::active{false};
+std::size_t Tracer::capacity = 1 << 18;
+Tracer::Clock::time_point Tracer::start = Tracer::Clock::now();
+
+namespace {
+    // buffers are owned here so they outlive the threads that filled them
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<Tracer::ThreadBuffer>>& registry(){
+        static std::vector<std::unique_ptr<Tracer::ThreadBuffer>> buffers;
+        return buffers;
+    }
+    thread_local Tracer::ThreadBuffer* threadBuffer = nullptr;
+
+    // empties every buffer and gives it the current capacity, so threads that already traced (long-lived
+    // pool and OpenMP workers) follow a new enable() as well; registryMutex must be held
+    void resetBuffers(std::size_t capacity){
+        for(auto& buffer : registry()){
+            buffer->count.store(0);
+            buffer->dropped.store(0);
+            if(buffer->events.size() != capacity)
+                std::vector<Tracer::Event>(capacity).swap(buffer->events);
+        }
+    }
+}
+
+void Tracer::enable(std::size_t eventsPerThread){
+    if(eventsPerThread == 0)
+        throw std::invalid_argument("Tracer needs room for at least one event per thread.");
+    std::lock_guard<std::mutex> lock(registryMutex);
+    capacity = eventsPerThread;
+    resetBuffers(capacity);
+    start = Clock::now();
+    active.store(true);
+}
+
+void Tracer::disable(){
+    active.store(false);
+}
+
+std::int64_t Tracer::now(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+Tracer::ThreadBuffer& Tracer::localBuffer(){
+    // first event on this thread registers its buffer, this is the only place a lock is taken
+    if(threadBuffer == nullptr){
+        std::lock_guard<std::mutex> lock(registryMutex);
+        auto buffer = std::make_unique<ThreadBuffer>();
+        buffer->events.resize(capacity);
+        buffer->tid = static_cast<int>(registry().size());
+        threadBuffer = buffer.get();
+        registry().push_back(std::move(buffer));
+    }
+    return *threadBuffer;
+}
+
+void Tracer::record(const char* name, std::int64_t begin, std::int64_t end){
+    ThreadBuffer& buffer = localBuffer();
+    std::size_t i = buffer.count.load(std::memory_order_relaxed);
+    if(i < buffer.events.size()){
+        buffer.events[i] = Event{name, begin, end};
+        buffer.count.store(i + 1, std::memory_order_release);
+    }else{
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Tracer::clear(){
+    std::lock_guard<std::mutex> lock(registryMutex);
+    resetBuffers(capacity);
+}
+
+std::size_t Tracer::numEvents(){
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::size_t n = 0;
+    for(auto& buffer : registry())
+        n += buffer->count.load(std::memory_order_acquire);
+    return n;
+}
+
+std::size_t Tracer::numDropped(){
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::size_t n = 0;
+    for(auto& buffer : registry())
+        n += buffer->dropped.load(std::memory_order_relaxed);
+    return n;
+}
+
+void Tracer::writeJSON(std::ostream& out){
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::size_t dropped = 0;
+    // trace-event timestamps are in microseconds
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    for(auto& buffer : registry()){
+        std::size_t n = buffer->count.load(std::memory_order_acquire);
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+        if(n == 0)
+            continue;
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+            << ",\"args\":{\"name\":\"thread " << buffer->tid << "\"}}";
+        for(std::size_t i=0; i<n; i++){
+            const Event& e = buffer->events[i];
+            out << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"nbody\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"ts\":" << e.begin/1000.0 << ",\"dur\":" << (e.end - e.begin)/1000.0 << "}";
+        }
+    }
+    out << "\n],\"otherData\":{\"droppedEvents\":" << dropped << "}}" << std::endl;
+}
+
+bool Tracer::writeJSON(const std::string& filename){
+    std::ofstream file(filename);
+    if(!file)
+        return false;
+    writeJSON(file);
+    return bool(file);
+}
+
+std::vector<Tracer::Total> Tracer::totals(){
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::vector<Total> result;
+    for(auto& buffer : registry()){
+        std::size_t n = buffer->count.load(std::memory_order_acquire);
+        for(std::size_t i=0; i<n; i++){
+            const Event& e = buffer->events[i];
+            auto total = std::find_if(result.begin(), result.end(), [&](const Total& t){
+                return t.name == e.name || std::strcmp(t.name, e.name) == 0;
+            });
+            if(total == result.end())
+                total = result.insert(result.end(), Total{e.name, 0, 0.0, 0.0});
+            double seconds = (e.end - e.begin)*1e-9;
+            total->calls++;
+            total->seconds += seconds;
+            total->maxSeconds = std::max(total->maxSeconds, seconds);
+        }
+    }
+    return result;
+}
+
+void Tracer::writeProfile(std::ostream& out){
+    out << "phase,calls,total_s,mean_us,max_us" << std::endl;
+    for(const Total& t : totals()){
+        out << t.name << "," << t.calls << "," << t.seconds << "," << 1e6*t.seconds/t.calls << ","
+            << 1e6*t.maxSeconds << std::endl;
+    }
+}
+
+bool Tracer::writeProfile(const std::string& filename){
+    std::ofstream file(filename);
+    if(!file)
+        return false;
+    writeProfile(file);
+    return bool(file);
+}
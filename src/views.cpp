@@ -0,0 +1,63 @@
+#include "views.hpp"
+#include "particle.hpp"
+
+#include <stdexcept>
+
+namespace {
+    pSystem& fromHandle(nbody_system* system){
+        return *reinterpret_cast<pSystem*>(system);
+    }
+
+    // strides of the Eigen maps are counted in elements, the particle store keeps them at whole multiples
+    std::ptrdiff_t elementStride(const nbody_view& view, std::size_t elementSize){
+        if(view.stride % elementSize != 0)
+            throw std::invalid_argument("View stride is not a multiple of its element size.");
+        return view.stride/elementSize;
+    }
+}
+
+nbody_system* cHandle(pSystem& system){
+    return reinterpret_cast<nbody_system*>(&system);
+}
+
+VectorsView asVectors(const nbody_view& view){
+    return VectorsView(static_cast<const double*>(view.data), 3, view.count, Eigen::OuterStride<>(elementStride(view, sizeof(double))));
+}
+
+ScalarsView asScalars(const nbody_view& view){
+    return ScalarsView(static_cast<const double*>(view.data), view.count, Eigen::InnerStride<>(elementStride(view, sizeof(double))));
+}
+
+IdsView asIds(const nbody_view& view){
+    return IdsView(static_cast<const std::uint64_t*>(view.data), view.count, Eigen::InnerStride<>(elementStride(view, sizeof(std::uint64_t))));
+}
+
+extern "C" {
+
+int nbody_abi_version(void){
+    return NBODY_ABI_VERSION;
+}
+
+size_t nbody_count(nbody_system* system){
+    pSystem& s = fromHandle(system);
+    s.compact();
+    return s.getNumOfParticles();
+}
+
+nbody_view nbody_positions(nbody_system* system){
+    return fromHandle(system).view(ParticleField::position);
+}
+
+nbody_view nbody_velocities(nbody_system* system){
+    return fromHandle(system).view(ParticleField::velocity);
+}
+
+nbody_view nbody_masses(nbody_system* system){
+    return fromHandle(system).view(ParticleField::mass);
+}
+
+nbody_view nbody_ids(nbody_system* system){
+    return fromHandle(system).view(ParticleField::id);
+}
+
+}
@@ -0,0 +1,321 @@
+#include "workstealing.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+
+struct WorkStealingDeque::Ring {
+    explicit Ring(std::size_t capacity) : mask{capacity - 1}, items{new std::atomic<std::uint64_t>[capacity]} {}
+
+    std::uint64_t get(std::int64_t i) const{
+        return items[i & mask].load(std::memory_order_relaxed);
+    }
+    void put(std::int64_t i, std::uint64_t task){
+        items[i & mask].store(task, std::memory_order_relaxed);
+    }
+    std::size_t capacity() const{
+        return mask + 1;
+    }
+
+    std::size_t mask;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> items;
+};
+
+WorkStealingDeque::WorkStealingDeque(std::size_t capacity){
+    // capacity is rounded up to a power of two so indices can be masked
+    std::size_t size = 2;
+    while(size < capacity)
+        size *= 2;
+    ring.store(new Ring(size), std::memory_order_relaxed);
+}
+
+WorkStealingDeque::~WorkStealingDeque(){
+    delete ring.load(std::memory_order_relaxed);
+    for(Ring* old : retired)
+        delete old;
+}
+
+WorkStealingDeque::Ring* WorkStealingDeque::grow(Ring* old, std::int64_t t, std::int64_t b){
+    Ring* bigger = new Ring(2*old->capacity());
+    for(std::int64_t i=t; i<b; i++)
+        bigger->put(i, old->get(i));
+    retired.push_back(old);
+    ring.store(bigger, std::memory_order_release);
+    return bigger;
+}
+
+void WorkStealingDeque::push(std::uint64_t task){
+    std::int64_t b = bottom.load(std::memory_order_relaxed);
+    std::int64_t t = top.load(std::memory_order_acquire);
+    Ring* r = ring.load(std::memory_order_relaxed);
+    if(b - t > static_cast<std::int64_t>(r->capacity()) - 1)
+        r = grow(r, t, b);
+    r->put(b, task);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+std::uint64_t WorkStealingDeque::pop(){
+    std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    Ring* r = ring.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t t = top.load(std::memory_order_relaxed);
+    if(t > b){
+        // empty
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return 0;
+    }
+    std::uint64_t task = r->get(b);
+    if(t == b){
+        // last task, race the thieves for it
+        if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            task = 0;
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return task;
+}
+
+std::uint64_t WorkStealingDeque::steal(){
+    std::int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t b = bottom.load(std::memory_order_acquire);
+    if(t >= b)
+        return 0;
+    Ring* r = ring.load(std::memory_order_acquire);
+    std::uint64_t task = r->get(t);
+    if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return 0;
+    return task;
+}
+
+std::size_t WorkStealingDeque::size() const{
+    std::int64_t b = bottom.load(std::memory_order_relaxed);
+    std::int64_t t = top.load(std::memory_order_relaxed);
+    return b > t ? static_cast<std::size_t>(b - t) : 0;
+}
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // a task is a range of chunk indices [first, last), packed into one word for the deque
+    std::uint64_t encode(std::uint64_t first, std::uint64_t last){
+        return (first << 32) | last;
+    }
+    std::uint64_t first(std::uint64_t task){
+        return task >> 32;
+    }
+    std::uint64_t last(std::uint64_t task){
+        return task & 0xffffffffu;
+    }
+
+    // pool and worker index of the calling thread while it runs inside a pool
+    thread_local const WorkStealingPool* currentPool = nullptr;
+    thread_local int currentWorker = 0;
+
+    // yields before a worker goes to sleep between loops, so back to back loops do not pay for a wake-up
+    const int spinLimit = 2000;
+}
+
+// statistics are only written by the owning worker, relaxed atomics so they can be read at any time
+struct WorkStealingPool::Worker {
+    WorkStealingDeque deque;
+    std::atomic<std::uint64_t> chunks{0};
+    std::atomic<std::uint64_t> steals{0};
+    std::atomic<std::uint64_t> failedSteals{0};
+    std::atomic<std::int64_t> idleNs{0};
+    std::uint64_t rng;
+    // keeps workers on separate cache lines
+    char padding[64];
+};
+
+WorkStealingPool::WorkStealingPool(int in_threads){
+    if(in_threads < 1)
+        throw std::invalid_argument("A thread pool needs at least one thread.");
+    for(int i=0; i<in_threads; i++){
+        workers.push_back(std::make_unique<Worker>());
+        workers.back()->rng = 0x9E3779B97F4A7C15ull*(i + 1);
+    }
+    for(int i=1; i<in_threads; i++)
+        threads.emplace_back([this, i]{ workerLoop(i); });
+}
+
+WorkStealingPool::~WorkStealingPool(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(std::thread& thread : threads)
+        thread.join();
+}
+
+int WorkStealingPool::numThreads() const{
+    return static_cast<int>(workers.size());
+}
+
+void WorkStealingPool::run(std::size_t begin, std::size_t end, std::size_t in_grain, Body in_body, void* in_context){
+    if(end <= begin)
+        return;
+    std::size_t n = end - begin;
+    in_grain = std::max<std::size_t>(in_grain, 1);
+    // chunk indices have to fit into half a task word
+    const std::size_t maxChunks = 0xffffffffu;
+    if(n/in_grain >= maxChunks)
+        in_grain = n/maxChunks + 1;
+    std::size_t numChunks = (n + in_grain - 1)/in_grain;
+
+    // nested loops run right here on the calling worker
+    if(currentPool == this){
+        for(std::size_t b=begin; b<end; b+=in_grain)
+            in_body(in_context, b, std::min(end, b + in_grain), currentWorker);
+        return;
+    }
+
+    // there is one loop state and one worker 0, so loops from several host threads take turns
+    std::lock_guard<std::mutex> submitted(submit);
+    // single chunks and one-thread pools run right here
+    if(numChunks == 1 || workers.size() == 1){
+        for(std::size_t b=begin; b<end; b+=in_grain)
+            in_body(in_context, b, std::min(end, b + in_grain), 0);
+        return;
+    }
+
+    body = in_body;
+    context = in_context;
+    loopBegin = begin;
+    loopEnd = end;
+    grain = in_grain;
+    remaining.store(numChunks, std::memory_order_relaxed);
+    // the push publishes the fields above to whoever takes the task
+    workers[0]->deque.push(encode(0, numChunks));
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        epoch.fetch_add(1, std::memory_order_release);
+    }
+    wake.notify_all();
+
+    currentPool = this;
+    currentWorker = 0;
+    work(0);
+    currentPool = nullptr;
+}
+
+void WorkStealingPool::workerLoop(int id){
+    currentPool = this;
+    currentWorker = id;
+    std::uint64_t seen = 0;
+    while(true){
+        // spin for a while before sleeping, the next loop usually follows right away
+        bool ready = false;
+        for(int i=0; i<spinLimit && !ready; i++){
+            ready = epoch.load(std::memory_order_acquire) != seen;
+            if(!ready)
+                std::this_thread::yield();
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]{ return stopping || epoch.load(std::memory_order_relaxed) != seen; });
+            if(stopping)
+                return;
+            seen = epoch.load(std::memory_order_relaxed);
+        }
+        work(id);
+    }
+}
+
+void WorkStealingPool::work(int id){
+    Worker& self = *workers[id];
+    bool idle = false;
+    Clock::time_point idleSince;
+    while(remaining.load(std::memory_order_acquire) > 0){
+        std::uint64_t task = findTask(id);
+        if(task != 0){
+            if(idle){
+                self.idleNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - idleSince).count(),
+                                      std::memory_order_relaxed);
+                idle = false;
+            }
+            execute(id, task);
+        }else{
+            if(!idle){
+                idle = true;
+                idleSince = Clock::now();
+            }
+            std::this_thread::yield();
+        }
+    }
+    if(idle){
+        self.idleNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - idleSince).count(),
+                              std::memory_order_relaxed);
+    }
+}
+
+std::uint64_t WorkStealingPool::findTask(int id){
+    Worker& self = *workers[id];
+    std::uint64_t task = self.deque.pop();
+    if(task != 0)
+        return task;
+
+    // one steal attempt from a random victim per call
+    self.rng ^= self.rng << 13;
+    self.rng ^= self.rng >> 7;
+    self.rng ^= self.rng << 17;
+    std::size_t victim = self.rng % (workers.size() - 1);
+    if(victim >= static_cast<std::size_t>(id))
+        victim++;
+    task = workers[victim]->deque.steal();
+    if(task != 0)
+        self.steals.fetch_add(1, std::memory_order_relaxed);
+    else
+        self.failedSteals.fetch_add(1, std::memory_order_relaxed);
+    return task;
+}
+
+void WorkStealingPool::execute(int id, std::uint64_t task){
+    Worker& self = *workers[id];
+    std::uint64_t f = first(task);
+    std::uint64_t l = last(task);
+    // keep the lower half and offer the upper half to thieves until one chunk is left
+    while(l - f > 1){
+        std::uint64_t mid = f + (l - f)/2;
+        self.deque.push(encode(mid, l));
+        l = mid;
+    }
+    std::size_t b = loopBegin + f*grain;
+    body(context, b, std::min(loopEnd, b + grain), id);
+    self.chunks.fetch_add(1, std::memory_order_relaxed);
+    remaining.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+WorkStealingPool::Stats WorkStealingPool::workerStats(int worker) const{
+    const Worker& w = *workers.at(worker);
+    Stats s;
+    s.chunks = w.chunks.load(std::memory_order_relaxed);
+    s.steals = w.steals.load(std::memory_order_relaxed);
+    s.failedSteals = w.failedSteals.load(std::memory_order_relaxed);
+    s.idleSeconds = w.idleNs.load(std::memory_order_relaxed)*1e-9;
+    return s;
+}
+
+WorkStealingPool::Stats WorkStealingPool::stats() const{
+    Stats total;
+    for(int i=0; i<numThreads(); i++){
+        Stats s = workerStats(i);
+        total.chunks += s.chunks;
+        total.steals += s.steals;
+        total.failedSteals += s.failedSteals;
+        total.idleSeconds += s.idleSeconds;
+    }
+    return total;
+}
+
+void WorkStealingPool::resetStats(){
+    for(auto& w : workers){
+        w->chunks.store(0, std::memory_order_relaxed);
+        w->steals.store(0, std::memory_order_relaxed);
+        w->failedSteals.store(0, std::memory_order_relaxed);
+        w->idleNs.store(0, std::memory_order_relaxed);
+    }
+}
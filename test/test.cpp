@@ -1,8 +1,27 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_floating_point.hpp>
 #include "particle.hpp"
+#include "trace.hpp"
+#include "allocation.hpp"
+#include "perfcounter.hpp"
+#include "views.hpp"
+#include "jobfile.hpp"
+#include "ensemble.hpp"
+#include "batch.hpp"
+#include "fixed.hpp"
+#include "isa.hpp"
 #include <Eigen/Core>
 #include <memory>
+#include <sstream>
+#include <cstdio>
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <fcntl.h>
+#include <unistd.h>
 
 using Catch::Matchers::WithinRel;
 
@@ -234,6 +253,28 @@ TEST_CASE("Parallelization works correctly", "[parallelization]"){
 
 }
 
+TEST_CASE("Persistent parallel region matches stepping by hand", "[persistentRegion]"){
+    solarSysGenerator generator1 = solarSysGenerator();
+    solarSysGenerator generator2 = solarSysGenerator();
+    std::unique_ptr<pSystem> s1 = generator1.generateInitialConditions();
+    std::unique_ptr<pSystem> s2 = generator2.generateInitialConditions();
+
+    // dt is a power of two so the time accumulation gives exactly 10 steps
+    double dt = 1.0/1024.0;
+    s1->evolveSystem(10*dt, dt);
+    for(int step=0; step<10; step++){
+        s2->updateAccelerations(0.0);
+        s2->updateVelPos(dt);
+    }
+
+    for(std::size_t i=0; i<s1->getNumOfParticles(); i++){
+        REQUIRE(s1->getParticle(i).getPosition()==s2->getParticle(i).getPosition());
+        REQUIRE(s1->getParticle(i).getVelocity()==s2->getParticle(i).getVelocity());
+    }
+
+    REQUIRE_THROWS(s1->evolveSystem(10*dt, dt, -1.0));
+}
+
 TEST_CASE("Energy calculation parallelizes correctly" ,"[Eparallelization]"){
     // Energy calculated without parallelization
     std::unique_ptr<pSystem> s1(new pSystem());
@@ -260,3 +301,1364 @@ TEST_CASE("Energy calculation parallelizes correctly" ,"[Eparallelization]"){
     REQUIRE_THAT((std::get<0>(E_tot) + std::get<1>(E_tot)), Catch::Matchers::WithinAbs(E_serial,1e9));
     
 }
+
+TEST_CASE("Tracer records per-thread events only when enabled", "[trace]"){
+    std::unique_ptr<pSystem> s1(new pSystem());
+    for(int i=0; i<16; i++){
+        s1->addParticle(Particle(1, Eigen::Vector3d(i, 0, 0), Eigen::Vector3d(0, 0, 0)));
+    }
+
+    // a buffer that exists from an earlier, larger enable() takes the new capacity
+    Tracer::enable();
+    Tracer::record("earlier", 0, 1);
+    Tracer::disable();
+
+    // disabled tracer must not record anything
+    Tracer::clear();
+    s1->evolveSystem(0.1, 0.01);
+    REQUIRE(Tracer::numEvents()==0);
+
+    Tracer::enable(16);
+    s1->evolveSystem(0.1, 0.01);
+    Tracer::disable();
+    REQUIRE(Tracer::numEvents()>0);
+    // 16 slots per thread are not enough for 10 steps, the rest is dropped instead of reallocating
+    REQUIRE(Tracer::numDropped()>0);
+
+    std::stringstream json;
+    Tracer::writeJSON(json);
+    REQUIRE(json.str().find("\"traceEvents\"")!=std::string::npos);
+    REQUIRE(json.str().find("\"updateAccelerations\"")!=std::string::npos);
+    REQUIRE(json.str().find("\"ph\":\"X\"")!=std::string::npos);
+
+    // the flat profile sums the same events per phase
+    std::vector<Tracer::Total> totals = Tracer::totals();
+    std::uint64_t calls = 0;
+    for(const Tracer::Total& total : totals){
+        calls += total.calls;
+        REQUIRE(total.seconds>=total.maxSeconds);
+    }
+    REQUIRE(calls==Tracer::numEvents());
+    std::stringstream profile;
+    Tracer::writeProfile(profile);
+    REQUIRE(profile.str().rfind("phase,calls,total_s,mean_us,max_us\n", 0)==0);
+    REQUIRE(profile.str().find("\nupdateVelPos,")!=std::string::npos);
+    Tracer::clear();
+}
+
+TEST_CASE("Execution planner picks serial for small and parallel for large systems", "[planner]"){
+    // 4 cores with 2 SMT siblings each on one socket
+    CpuTopology topology;
+    for(int id=0; id<8; id++){
+        topology.cpus.push_back(CpuTopology::Cpu{id, id%4, 0});
+    }
+    topology.numCores = 4;
+    REQUIRE(topology.hasSMT());
+
+    // 2ns per pair, 5us of barriers per step on any thread count
+    ExecutionPlanner planner(topology);
+    planner.setCalibration(2e-9, std::vector<double>(9, 5e-6));
+
+    ExecutionPlan small = planner.plan(9);
+    REQUIRE(!small.parallel);
+    REQUIRE(small.threads==1);
+
+    // by default the physical cores are the limit
+    ExecutionPlan large = planner.plan(4096);
+    REQUIRE(large.parallel);
+    REQUIRE(large.threads==4);
+    REQUIRE(!large.useSMT);
+
+    // with SMT the siblings are worth a fraction of a core each
+    planner.setSMT(true);
+    large = planner.plan(4096);
+    REQUIRE(large.threads>4);
+    REQUIRE(large.useSMT);
+    planner.setSMT(false);
+
+    // user override wins over the model
+    planner.setThreads(3);
+    REQUIRE(planner.plan(9).threads==3);
+    REQUIRE(planner.plan(9).reason=="user override");
+}
+
+TEST_CASE("Serial execution plan gives the same result as the parallel one", "[serialPlan]"){
+    randomSysGenerator generator1 = randomSysGenerator(32);
+    randomSysGenerator generator2 = randomSysGenerator(32);
+    std::unique_ptr<pSystem> s1 = generator1.generateInitialConditions();
+    std::unique_ptr<pSystem> s2 = generator2.generateInitialConditions();
+
+    ExecutionPlan serial;
+    serial.parallel = false;
+    s1->setExecutionPlan(serial);
+    ExecutionPlan parallel;
+    parallel.threads = 3;
+    s2->setExecutionPlan(parallel);
+    ExecutionPlan negative;
+    negative.threads = -1;
+    REQUIRE_THROWS(s2->setExecutionPlan(negative));
+
+    s1->evolveSystem(0.1, 0.001);
+    s2->evolveSystem(0.1, 0.001);
+    // every particle sums its forces in the same order on any thread count
+    for(int i=0; i<32; i++){
+        REQUIRE(s1->getParticle(i).getPosition()==s2->getParticle(i).getPosition());
+    }
+}
+
+TEST_CASE("Thread placement and first-touch particle store", "[placement]"){
+    // 2 sockets with 2 cores and 2 SMT siblings each, siblings are numbered after all cores like on Linux
+    CpuTopology topology;
+    for(int id=0; id<8; id++){
+        topology.cpus.push_back(CpuTopology::Cpu{id, (id%4)%2, (id%4)/2});
+    }
+    topology.numCores = 4;
+    topology.numSockets = 2;
+
+    REQUIRE(topology.placement(ThreadPinning::none, 4).empty());
+    REQUIRE(topology.placement(ThreadPinning::compact, 4)==std::vector<int>{0, 1, 2, 3});
+    REQUIRE(topology.placement(ThreadPinning::scatter, 4)==std::vector<int>{0, 2, 1, 3});
+    REQUIRE(topology.placement(ThreadPinning::compact, 6)==std::vector<int>{0, 1, 2, 3, 4, 5});
+    REQUIRE(topology.placement(ThreadPinning::scatter, 6)==std::vector<int>{0, 2, 1, 3, 4, 6});
+
+    ExecutionPlanner planner(topology);
+    planner.setThreads(2);
+    planner.setPinning(ThreadPinning::scatter);
+    planner.setFirstTouch(true);
+    ExecutionPlan plan = planner.plan(100);
+    REQUIRE(plan.cpus==std::vector<int>{0, 2});
+    REQUIRE(plan.firstTouch);
+
+    // re-placing the store keeps every particle where it was
+    randomSysGenerator generator = randomSysGenerator(5000);
+    std::unique_ptr<pSystem> s1 = generator.generateInitialConditions();
+    Eigen::Vector3d p = s1->getParticle(4321).getPosition();
+    double m = s1->getParticle(4321).getMass();
+    ExecutionPlan placed;
+    placed.firstTouch = true;
+    s1->setExecutionPlan(placed);
+    REQUIRE(s1->getNumOfParticles()==5000);
+    REQUIRE(s1->getParticle(4321).getPosition()==p);
+    REQUIRE(s1->getParticle(4321).getMass()==m);
+
+    // growing the store constructs nothing, so the threads that fill it in are the first to touch its pages
+    std::vector<Particle, ParticleAllocator<Particle>> store;
+    store.reserve(64);
+    unsigned char* bytes = reinterpret_cast<unsigned char*>(store.data());
+    std::fill(bytes, bytes + 64*sizeof(Particle), 0xa5);
+    store.resize(64);
+    REQUIRE(reinterpret_cast<unsigned char*>(store.data())==bytes);
+    REQUIRE(std::all_of(bytes, bytes + 64*sizeof(Particle), [](unsigned char b){ return b==0xa5; }));
+}
+
+TEST_CASE("2D block decomposition of the force loop", "[blocks]"){
+    randomSysGenerator generator1 = randomSysGenerator(100);
+    randomSysGenerator generator2 = randomSysGenerator(100);
+    randomSysGenerator generator3 = randomSysGenerator(100);
+    std::unique_ptr<pSystem> rows = generator1.generateInitialConditions();
+    std::unique_ptr<pSystem> blocks1 = generator2.generateInitialConditions();
+    std::unique_ptr<pSystem> blocks4 = generator3.generateInitialConditions();
+
+    // the tile size is fixed, so the reduction order is the same on any number of threads
+    ExecutionPlan plan;
+    plan.decomposition = ForceDecomposition::blocks;
+    plan.tileSize = 16;
+    plan.parallel = false;
+    blocks1->setExecutionPlan(plan);
+    plan.parallel = true;
+    plan.threads = 4;
+    blocks4->setExecutionPlan(plan);
+
+    rows->evolveSystem(0.05, 0.001);
+    blocks1->evolveSystem(0.05, 0.001);
+    blocks4->evolveSystem(0.05, 0.001);
+
+    for(int i=0; i<100; i++){
+        REQUIRE(blocks1->getParticle(i).getPosition()==blocks4->getParticle(i).getPosition());
+        REQUIRE(blocks1->getParticle(i).getVelocity()==blocks4->getParticle(i).getVelocity());
+        REQUIRE(rows->getParticle(i).getPosition().isApprox(blocks4->getParticle(i).getPosition(), 1e-12));
+    }
+
+    // accelerations alone, tile size not dividing n
+    std::unique_ptr<pSystem> s1(new pSystem());
+    s1->addParticle(Particle(100, Eigen::Vector3d(0,0,0), Eigen::Vector3d(1, 0, 0)));
+    s1->addParticle(Particle(100, Eigen::Vector3d(1,0,0), Eigen::Vector3d(1, 0, 0)));
+    s1->addParticle(Particle(100, Eigen::Vector3d(-1,0,0), Eigen::Vector3d(1, 0, 0)));
+    plan.tileSize = 2;
+    s1->setExecutionPlan(plan);
+    s1->updateAccelerations(0.0);
+    REQUIRE(s1->getParticle(0).getAcceleration().isApprox(Eigen::Vector3d(0,0,0),0.0001));
+    REQUIRE(s1->getParticle(1).getAcceleration().isApprox(Eigen::Vector3d(-125,0,0),0.0001));
+    REQUIRE(s1->getParticle(2).getAcceleration().isApprox(Eigen::Vector3d(125,0,0),0.0001));
+}
+
+TEST_CASE("Planner uses blocks when there are too few rows per thread", "[blocksPlanner]"){
+    CpuTopology topology;
+    for(int id=0; id<64; id++){
+        topology.cpus.push_back(CpuTopology::Cpu{id, id, 0});
+    }
+    topology.numCores = 64;
+
+    ExecutionPlanner planner(topology);
+    planner.setCalibration(2e-8, std::vector<double>(65, 1e-6));
+    // 200 rows on 64 threads: rows leaves a quarter of the threads idle for a quarter of the step
+    ExecutionPlan plan = planner.plan(200);
+    REQUIRE(plan.threads==64);
+    REQUIRE(plan.decomposition==ForceDecomposition::blocks);
+
+    // rows divide evenly
+    REQUIRE(planner.plan(256*64).decomposition==ForceDecomposition::rows);
+
+    planner.setDecomposition(ForceDecomposition::rows);
+    REQUIRE(planner.plan(200).decomposition==ForceDecomposition::rows);
+}
+
+TEST_CASE("Work-stealing deque keeps every task exactly once", "[deque]"){
+    WorkStealingDeque deque(4);
+    REQUIRE(deque.pop()==0);
+    REQUIRE(deque.steal()==0);
+
+    // more tasks than the initial capacity makes the ring grow
+    for(std::uint64_t i=1; i<=10; i++){
+        deque.push(i);
+    }
+    REQUIRE(deque.size()==10);
+    // owner takes the newest, thieves the oldest
+    REQUIRE(deque.pop()==10);
+    REQUIRE(deque.steal()==1);
+    REQUIRE(deque.size()==8);
+}
+
+TEST_CASE("Work-stealing pool runs every iteration once", "[pool]"){
+    WorkStealingPool pool(4);
+    REQUIRE(pool.numThreads()==4);
+
+    // irregular work: the cost of iteration i grows with i
+    const std::size_t n = 2000;
+    std::vector<std::atomic<int>> visits(n);
+    std::vector<double> result(n, 0.0);
+    std::atomic<int> badWorker{0};
+    pool.parallelFor(0, n, 7, [&](std::size_t b, std::size_t e, int worker){
+        // Catch assertions are not thread safe, count problems and check them afterwards
+        if(worker<0 || worker>=4)
+            badWorker++;
+        for(std::size_t i=b; i<e; i++){
+            visits[i]++;
+            for(std::size_t k=0; k<i; k++)
+                result[i] += 1.0;
+        }
+    });
+    REQUIRE(badWorker==0);
+    for(std::size_t i=0; i<n; i++){
+        REQUIRE(visits[i]==1);
+        REQUIRE(result[i]==double(i));
+    }
+    WorkStealingPool::Stats stats = pool.stats();
+    REQUIRE(stats.chunks==(n + 6)/7);
+
+    // a loop inside a loop runs on the calling worker
+    std::atomic<int> inner{0};
+    pool.parallelFor(0, 8, 1, [&](std::size_t, std::size_t, int){
+        pool.parallelFor(0, 10, 1, [&](std::size_t b, std::size_t e, int){ inner += e - b; });
+    });
+    REQUIRE(inner==80);
+
+    // loops submitted from two host threads at once take turns
+    std::vector<std::atomic<int>> counts(2*n);
+    auto submitter = [&](std::size_t offset){
+        for(int loop=0; loop<20; loop++)
+            pool.parallelFor(offset, offset + n, 16, [&](std::size_t b, std::size_t e, int){
+                for(std::size_t i=b; i<e; i++)
+                    counts[i]++;
+            });
+    };
+    std::thread first(submitter, 0);
+    std::thread second(submitter, n);
+    first.join();
+    second.join();
+    for(std::size_t i=0; i<2*n; i++){
+        REQUIRE(counts[i]==20);
+    }
+
+    pool.resetStats();
+    REQUIRE(pool.stats().chunks==0);
+}
+
+TEST_CASE("Evolving on the work-stealing pool matches OpenMP", "[poolEvolve]"){
+    randomSysGenerator generator1 = randomSysGenerator(50);
+    randomSysGenerator generator2 = randomSysGenerator(50);
+    std::unique_ptr<pSystem> s1 = generator1.generateInitialConditions();
+    std::unique_ptr<pSystem> s2 = generator2.generateInitialConditions();
+
+    auto pool = std::make_shared<WorkStealingPool>(3);
+    s2->setExecutor(std::make_shared<PoolExecutor>(pool));
+    s1->evolveSystem(0.05, 0.001);
+    s2->evolveSystem(0.05, 0.001);
+    for(int i=0; i<50; i++){
+        REQUIRE(s1->getParticle(i).getPosition()==s2->getParticle(i).getPosition());
+        REQUIRE(s1->getParticle(i).getVelocity()==s2->getParticle(i).getVelocity());
+    }
+    REQUIRE(pool->stats().chunks>0);
+}
+
+// stands in for the thread pool of a host process, runs ranges on short-lived threads and counts calls
+class HostExecutor : public Executor {
+    public:
+        const char* name() const override { return "host"; }
+        int concurrency() const override { return 2; }
+        void parallelFor(std::size_t begin, std::size_t end, std::size_t, RangeFunction body) override{
+            calls++;
+            std::size_t mid = begin + (end - begin)/2;
+            std::thread other([&]{ body(begin, mid); });
+            body(mid, end);
+            other.join();
+        }
+        int calls = 0;
+};
+
+TEST_CASE("Execution backends give the same results", "[backends]"){
+    ExecutionPlan pool;
+    pool.backend = Backend::pool;
+    pool.threads = 2;
+    ExecutionPlan serial;
+    serial.backend = Backend::serial;
+
+    randomSysGenerator generator = randomSysGenerator(40);
+    std::unique_ptr<pSystem> reference = generator.generateInitialConditions();
+    std::tuple<double, double> E = reference->getEnergy();
+    reference->evolveSystem(0.05, 0.001);
+    // a build without OpenMP runs the default plan on the pool instead of silently serially
+    REQUIRE(std::string(reference->getBackendName())==(openMPAvailable() ? "OpenMP" : "work-stealing pool"));
+
+    std::vector<std::unique_ptr<pSystem>> systems;
+    for(int i=0; i<3; i++){
+        randomSysGenerator g = randomSysGenerator(40);
+        systems.push_back(g.generateInitialConditions());
+    }
+    systems[0]->setExecutionPlan(pool);
+    systems[1]->setExecutionPlan(serial);
+    auto host = std::make_shared<HostExecutor>();
+    systems[2]->setExecutor(host);
+    // an external executor stays in place when the plan changes
+    systems[2]->setExecutionPlan(pool);
+    REQUIRE(std::string(systems[0]->getBackendName())=="work-stealing pool");
+    REQUIRE(std::string(systems[1]->getBackendName())=="serial");
+    REQUIRE(std::string(systems[2]->getBackendName())=="host");
+
+    for(auto& s : systems){
+        std::tuple<double, double> E_s = s->getEnergy();
+        REQUIRE_THAT(std::get<0>(E_s) + std::get<1>(E_s), WithinRel(std::get<0>(E) + std::get<1>(E), 1e-12));
+        s->evolveSystem(0.05, 0.001);
+        for(int i=0; i<40; i++){
+            REQUIRE(s->getParticle(i).getPosition()==reference->getParticle(i).getPosition());
+        }
+    }
+    REQUIRE(host->calls>0);
+
+    // back to the plan's backend
+    systems[2]->setExecutor(nullptr);
+    REQUIRE(std::string(systems[2]->getBackendName())=="work-stealing pool");
+}
+
+TEST_CASE("Deterministic mode gives identical bits on any thread count", "[deterministic]"){
+    // serial rows, OpenMP rows and blocks on different thread counts, and the pool must all agree exactly
+    std::vector<ExecutionPlan> plans(4);
+    plans[0].parallel = false;
+    plans[1].threads = 3;
+    plans[2].threads = 4;
+    plans[2].decomposition = ForceDecomposition::blocks;
+    plans[3].threads = 3;
+    plans[3].backend = Backend::pool;
+    plans[3].decomposition = ForceDecomposition::blocks;
+
+    std::vector<std::unique_ptr<pSystem>> systems;
+    for(ExecutionPlan& plan : plans){
+        plan.deterministic = true;
+        plan.tileSize = 64;
+        randomSysGenerator g = randomSysGenerator(300);
+        systems.push_back(g.generateInitialConditions());
+        systems.back()->setExecutionPlan(plan);
+    }
+
+    std::tuple<double, double> E = systems[0]->getEnergy();
+    systems[0]->evolveSystem(0.003, 0.001);
+    for(std::size_t s=1; s<systems.size(); s++){
+        std::tuple<double, double> E_s = systems[s]->getEnergy();
+        REQUIRE(std::get<0>(E_s)==std::get<0>(E));
+        REQUIRE(std::get<1>(E_s)==std::get<1>(E));
+        systems[s]->evolveSystem(0.003, 0.001);
+        for(int i=0; i<300; i++){
+            REQUIRE(systems[s]->getParticle(i).getPosition()==systems[0]->getParticle(i).getPosition());
+            REQUIRE(systems[s]->getParticle(i).getVelocity()==systems[0]->getParticle(i).getVelocity());
+        }
+    }
+
+    ExecutionPlanner planner;
+    planner.setThreads(2);
+    planner.setDeterministic(true);
+    REQUIRE(planner.plan(100).deterministic);
+}
+
+TEST_CASE("Space-filling curve keys", "[curves]"){
+    REQUIRE(mortonKey(0, 0, 0)==0);
+    REQUIRE(mortonKey(1, 0, 0)==1);
+    REQUIRE(mortonKey(0, 1, 0)==2);
+    REQUIRE(mortonKey(0, 0, 1)==4);
+    REQUIRE(mortonKey(3, 3, 3)==63);
+
+    // walking a 8x8x8 grid in Hilbert order visits every cell once and only ever steps to a face neighbour
+    std::vector<std::pair<std::uint64_t, Eigen::Vector3i>> cells;
+    const std::uint32_t shift = 18;
+    for(int x=0; x<8; x++)
+        for(int y=0; y<8; y++)
+            for(int z=0; z<8; z++)
+                cells.push_back({hilbertKey(x << shift, y << shift, z << shift), Eigen::Vector3i(x, y, z)});
+    std::sort(cells.begin(), cells.end(), [](const auto& a, const auto& b){ return a.first < b.first; });
+    for(std::size_t i=1; i<cells.size(); i++){
+        REQUIRE(cells[i].first!=cells[i - 1].first);
+        REQUIRE((cells[i].second - cells[i - 1].second).cwiseAbs().sum()==1);
+    }
+}
+
+TEST_CASE("Parallel radix sort is a stable sort", "[radix]"){
+    std::mt19937_64 rng(7);
+    std::vector<std::uint64_t> input(50000);
+    for(std::uint64_t& k : input)
+        k = rng() % 1000 + (rng() % 3 << 40);
+    std::vector<std::uint32_t> expected(input.size());
+    std::iota(expected.begin(), expected.end(), 0u);
+    std::stable_sort(expected.begin(), expected.end(), [&](std::uint32_t a, std::uint32_t b){ return input[a] < input[b]; });
+
+    PoolExecutor pool(std::make_shared<WorkStealingPool>(3));
+    for(Executor* executor : {static_cast<Executor*>(nullptr), static_cast<Executor*>(&pool)}){
+        std::vector<std::uint64_t> keys = input;
+        std::vector<std::uint32_t> order;
+        radixSortByKey(keys, order, executor, 4);
+        REQUIRE(order==expected);
+        REQUIRE(std::is_sorted(keys.begin(), keys.end()));
+        REQUIRE(curveDisorder(keys)==0.0);
+    }
+}
+
+TEST_CASE("Reordering keeps ids and physics", "[reorder]"){
+    randomSysGenerator g1 = randomSysGenerator(200);
+    randomSysGenerator g2 = randomSysGenerator(200);
+    std::unique_ptr<pSystem> reference = g1.generateInitialConditions();
+    std::unique_ptr<pSystem> sorted = g2.generateInitialConditions();
+    for(int i=0; i<200; i++){
+        REQUIRE(reference->getParticle(i).getId()==std::uint64_t(i));
+    }
+
+    std::tuple<double, double> E = reference->getEnergy();
+    sorted->setReordering(SpaceCurve::hilbert, 2);
+    REQUIRE(sorted->getReorderStats().reorders==1);
+    std::tuple<double, double> E_sorted = sorted->getEnergy();
+    REQUIRE_THAT(std::get<0>(E_sorted) + std::get<1>(E_sorted), WithinRel(std::get<0>(E) + std::get<1>(E), 1e-12));
+
+    reference->evolveSystem(0.02, 0.001);
+    sorted->evolveSystem(0.02, 0.001);
+    REQUIRE(sorted->getReorderStats().checks>0);
+    std::vector<bool> seen(200, false);
+    for(int i=0; i<200; i++){
+        const Particle& p = sorted->getParticle(i);
+        REQUIRE(p.getId()<200);
+        REQUIRE(!seen[p.getId()]);
+        seen[p.getId()] = true;
+        const Particle& q = reference->getParticle(p.getId());
+        REQUIRE((p.getPosition() - q.getPosition()).norm()<1e-12);
+        REQUIRE(p.getMass()==q.getMass());
+    }
+}
+
+TEST_CASE("Arena hands out aligned memory and settles on one block", "[arena]"){
+    Arena arena(256);
+    for(int step=0; step<3; step++){
+        for(int i=0; i<20; i++){
+            void* p = arena.allocate(100, 64);
+            REQUIRE(reinterpret_cast<std::uintptr_t>(p) % 64==0);
+        }
+        REQUIRE(arena.bytesUsed()==2000);
+        arena.reset();
+    }
+    REQUIRE(arena.bytesUsed()==0);
+    REQUIRE(arena.peakBytes()==2000);
+    // after the first reset all of a step fits into one block, so the capacity stays put
+    std::size_t capacity = arena.capacity();
+    for(int i=0; i<20; i++)
+        arena.allocate(100, 64);
+    REQUIRE(arena.capacity()==capacity);
+    REQUIRE(arena.numResets()==3);
+
+    std::vector<int, ArenaAllocator<int>> v{ArenaAllocator<int>(&arena)};
+    for(int i=0; i<1000; i++)
+        v.push_back(i);
+    REQUIRE(v[999]==999);
+
+    ArenaGroup group;
+    Arena* mine = &group.local();
+    Arena* other = nullptr;
+    std::thread t([&]{ other = &group.local(); });
+    t.join();
+    REQUIRE(mine==&group.local());
+    REQUIRE(mine!=other);
+    REQUIRE(group.arenaStats().size()==2);
+}
+
+TEST_CASE("Object pool reuses freed slots", "[objectPool]"){
+    ObjectPool<Eigen::Vector3d> pool(4);
+    std::vector<Eigen::Vector3d*> live;
+    for(int i=0; i<6; i++)
+        live.push_back(pool.create(i, 0.0, 0.0));
+    REQUIRE((*live[5])(0)==5.0);
+    REQUIRE(pool.stats().capacity==8);
+    Eigen::Vector3d* freed = live[2];
+    pool.destroy(freed);
+    REQUIRE(pool.create(7.0, 0.0, 0.0)==freed);
+    REQUIRE(pool.stats().live==6);
+    REQUIRE(pool.stats().peakLive==6);
+    REQUIRE(pool.stats().capacity==8);
+
+    // pSystem's temporaries come from its arenas
+    randomSysGenerator g = randomSysGenerator(50);
+    std::unique_ptr<pSystem> s = g.generateInitialConditions();
+    ExecutionPlan deterministic;
+    deterministic.deterministic = true;
+    deterministic.tileSize = 8;
+    s->setExecutionPlan(deterministic);
+    s->getEnergy();
+    REQUIRE(s->getScratch().stats().bytesUsed>=2*7*sizeof(double));
+
+    // and so do the partial accelerations of the block decomposition, 7x7 tiles of 8 for 50 bodies
+    ExecutionPlan blocks;
+    blocks.decomposition = ForceDecomposition::blocks;
+    blocks.tileSize = 8;
+    s->setExecutionPlan(blocks);
+    s->evolveSystem(0.0105, 0.001);
+    REQUIRE(s->getScratch().stats().bytesUsed>=7*50*sizeof(Eigen::Vector3d));
+}
+
+TEST_CASE("Stepping does not allocate in steady state", "[allocations]"){
+    REQUIRE(AllocationTracker::hooked());
+
+    // the hook sees allocations and puts them into the phase of the enclosing TraceScope
+    AllocationTracker::reset();
+    AllocationTracker::enable();
+    {
+        std::vector<int> outside(10);
+        TraceScope scope("allocationTest");
+        std::vector<int> inside(5);
+    }
+    AllocationTracker::disable();
+    REQUIRE(AllocationTracker::numAllocations()==2);
+    std::vector<AllocationTracker::Phase> phases = AllocationTracker::phases();
+    REQUIRE(phases.size()==2);
+    REQUIRE(std::string(phases[1].name)=="allocationTest");
+    REQUIRE(phases[1].bytes==5*sizeof(int));
+
+    std::vector<ExecutionPlan> plans(5);
+    plans[0].parallel = false;
+    plans[1].threads = 2;
+    plans[2].threads = 2;
+    plans[2].decomposition = ForceDecomposition::blocks;
+    plans[3].threads = 2;
+    plans[3].backend = Backend::pool;
+    plans[3].decomposition = ForceDecomposition::blocks;
+    plans[4].threads = 2;
+    plans[4].deterministic = true;
+    plans[4].tileSize = 16;
+    const double dt = 1.0/1024;
+    for(std::size_t k=0; k<plans.size(); k++){
+        randomSysGenerator g = randomSysGenerator(100);
+        std::unique_ptr<pSystem> s = g.generateInitialConditions();
+        s->setExecutionPlan(plans[k]);
+        if(plans[k].deterministic)
+            s->setReordering(SpaceCurve::hilbert, 1);
+        // the first run sizes the scratch space, starts the threads and settles the arenas
+        s->evolveSystem(10*dt, dt);
+        s->reorder(SpaceCurve::morton);
+
+        AllocationTracker::reset();
+        AllocationTracker::enable();
+        s->evolveSystem(10*dt, dt);
+        s->reorder(SpaceCurve::morton);
+        AllocationTracker::disable();
+        std::stringstream report;
+        AllocationTracker::report(report);
+        INFO("plan " << k << ": " << report.str());
+        REQUIRE(AllocationTracker::numSteps()==10);
+        REQUIRE(AllocationTracker::numAllocations()==0);
+    }
+}
+
+TEST_CASE("Huge page policy keeps blocks aligned and freeable", "[hugePages]"){
+    for(HugePages policy : {HugePages::off, HugePages::transparent, HugePages::reserved}){
+        setHugePages(policy);
+        const std::size_t bytes = 3*hugePageSize + 100;
+        char* block = static_cast<char*>(allocateBlock(bytes));
+        REQUIRE(reinterpret_cast<std::uintptr_t>(block) % hugePageSize==0);
+        block[0] = 1;
+        block[bytes - 1] = 2;
+        freeBlock(block, bytes);
+    }
+    HugePageStats stats = hugePageStats();
+    // reserved pages either came from the pool or fell back to transparent ones
+    REQUIRE((stats.reservedBytes>0 || stats.fallbacks>0));
+
+    // the particle store goes through the same blocks, freeing must not depend on the policy in force
+    setHugePages(HugePages::transparent);
+    std::unique_ptr<pSystem> s;
+    {
+        randomSysGenerator g = randomSysGenerator(40000);
+        s = g.generateInitialConditions();
+    }
+    setHugePages(HugePages::off);
+    REQUIRE(s->getParticle(39999).getMass()>0);
+    s.reset();
+
+    PerfCounter misses(PerfCounter::Event::dtlbLoadMisses);
+    misses.start();
+    misses.stop();
+    if(!misses.available())
+        REQUIRE(misses.read()==0);
+
+    // dTLB load misses of all threads over the same steps, with the particles on small and on huge pages
+    std::uint64_t counts[2] = {0, 0};
+    const HugePages policies[2] = {HugePages::off, HugePages::transparent};
+    for(int k=0; k<2; k++){
+        setHugePages(policies[k]);
+        std::unique_ptr<pSystem> system = randomSysGenerator(4000).generateInitialConditions();
+        ExecutionPlan parallel;
+        parallel.firstTouch = true;
+        system->setExecutionPlan(parallel);
+        system->getEnergy();
+        PerfCounter all(PerfCounter::Event::dtlbLoadMisses, PerfCounter::Scope::process);
+        all.start();
+        system->evolveSystem(0.0025, 0.001);
+        all.stop();
+        if(!all.available()){
+            REQUIRE(all.read()==0);
+            REQUIRE(all.threads()==0);
+            continue;
+        }
+        REQUIRE(all.threads()>=1);
+        counts[k] = all.read();
+    }
+    setHugePages(HugePages::off);
+    if(PerfCounter(PerfCounter::Event::dtlbLoadMisses, PerfCounter::Scope::process).available())
+        WARN("dTLB load misses of 2 steps of 4000 bodies: " << counts[0] << " with huge pages off, " << counts[1] << " transparent");
+}
+
+TEST_CASE("Bulk particle ingestion", "[addParticles]"){
+    const std::size_t n = 3000;
+    std::vector<double> masses(n);
+    std::vector<double> positions(3*n);
+    std::vector<double> velocities(3*n);
+    for(std::size_t i=0; i<n; i++){
+        masses[i] = 1.0 + i;
+        for(int d=0; d<3; d++){
+            positions[3*i + d] = i + 0.1*d;
+            velocities[3*i + d] = -0.5*i + d;
+        }
+    }
+
+    ExecutionPlan pool;
+    pool.threads = 3;
+    pool.backend = Backend::pool;
+    for(bool onPool : {false, true}){
+        pSystem s;
+        if(onPool)
+            s.setExecutionPlan(pool);
+        s.addParticle(Particle(2.0, Eigen::Vector3d(1, 2, 3), Eigen::Vector3d(0, 0, 0)));
+        s.reserve(n + 1);
+        s.addParticles(n, masses.data(), positions.data(), velocities.data());
+        REQUIRE(s.getNumOfParticles()==n + 1);
+        for(std::size_t i=0; i<n; i++){
+            Particle& p = s.getParticle(i + 1);
+            REQUIRE(p.getId()==i + 1);
+            REQUIRE(p.getMass()==masses[i]);
+            REQUIRE(p.getPosition()==Eigen::Vector3d(positions[3*i], positions[3*i + 1], positions[3*i + 2]));
+            REQUIRE(p.getVelocity()==Eigen::Vector3d(velocities[3*i], velocities[3*i + 1], velocities[3*i + 2]));
+            REQUIRE(p.getAcceleration()==Eigen::Vector3d(0, 0, 0));
+        }
+
+        // a bad body anywhere rejects the whole batch
+        masses[n/2] = 0.0;
+        REQUIRE_THROWS_AS(s.addParticles(n, masses.data(), positions.data(), velocities.data()), std::invalid_argument);
+        masses[n/2] = 1.0;
+        REQUIRE(s.getNumOfParticles()==n + 1);
+        REQUIRE_THROWS_AS(s.deleteParticle(n + 1), std::out_of_range);
+    }
+
+    std::vector<Eigen::Vector3d> onePosition(1, Eigen::Vector3d(1, 1, 1));
+    pSystem s;
+    REQUIRE_THROWS_AS(s.addParticles(std::vector<double>{1.0, 2.0}, onePosition, onePosition), std::invalid_argument);
+}
+
+TEST_CASE("Deleting particles leaves tombstones until compaction", "[tombstones]"){
+    randomSysGenerator g1 = randomSysGenerator(100);
+    randomSysGenerator g2 = randomSysGenerator(100);
+    std::unique_ptr<pSystem> s = g1.generateInitialConditions();
+    std::unique_ptr<pSystem> full = g2.generateInitialConditions();
+
+    // indices from before the batch stay valid during it
+    for(std::size_t i=1; i<100; i+=3)
+        s->deleteParticle(i);
+    REQUIRE(s->getNumOfParticles()==67);
+    REQUIRE(s->getParticle(99).getId()==99);
+    REQUIRE_THROWS_AS(s->getParticle(1), std::out_of_range);
+    REQUIRE_THROWS_AS(s->deleteParticle(1), std::out_of_range);
+
+    // the same system built without the deleted bodies
+    pSystem reference;
+    for(std::size_t i=0; i<100; i++){
+        if(i % 3 != 1){
+            const Particle& p = full->getParticle(i);
+            reference.addParticle(Particle(p.getMass(), p.getPosition(), p.getVelocity()));
+        }
+    }
+    std::tuple<double, double> E = s->getEnergy();
+    std::tuple<double, double> E_ref = reference.getEnergy();
+    // the OpenMP reduction adds the thread sums in any order
+    REQUIRE_THAT(std::get<0>(E), WithinRel(std::get<0>(E_ref), 1e-12));
+    REQUIRE_THAT(std::get<1>(E), WithinRel(std::get<1>(E_ref), 1e-12));
+
+    // compaction kept the order and the ids of the survivors
+    REQUIRE(s->getNumOfParticles()==67);
+    std::uint64_t last = 0;
+    for(std::size_t i=0; i<67; i++){
+        std::uint64_t id = s->getParticle(i).getId();
+        REQUIRE(id % 3!=1);
+        REQUIRE((i==0 || id>last));
+        last = id;
+    }
+    s->evolveSystem(0.01, 0.001);
+    reference.evolveSystem(0.01, 0.001);
+    for(std::size_t i=0; i<67; i++){
+        REQUIRE(s->getParticle(i).getPosition()==reference.getParticle(i).getPosition());
+    }
+}
+
+TEST_CASE("Particle ids find their particles after reordering and compaction", "[handles]"){
+    randomSysGenerator g = randomSysGenerator(500);
+    std::unique_ptr<pSystem> s = g.generateInitialConditions();
+    std::vector<double> masses(500);
+    for(std::uint64_t id=0; id<500; id++){
+        REQUIRE(s->indexOf(id)==id);
+        masses[id] = s->getParticleById(id).getMass();
+    }
+
+    s->reorder(SpaceCurve::hilbert);
+    for(std::size_t i=0; i<500; i+=7)
+        s->deleteParticleById(s->getParticle(i).getId());
+    s->evolveSystem(0.002, 0.001);
+    s->reorder(SpaceCurve::morton);
+
+    std::vector<std::uint64_t> ids(600);
+    std::iota(ids.begin(), ids.end(), 0);
+    std::vector<std::size_t> slots(ids.size());
+    s->indicesOf(ids.data(), ids.size(), slots.data());
+    std::size_t found = 0;
+    for(std::uint64_t id=0; id<ids.size(); id++){
+        if(slots[id]==pSystem::noParticle){
+            REQUIRE_THROWS_AS(s->indexOf(id), std::out_of_range);
+            continue;
+        }
+        found++;
+        REQUIRE(s->indexOf(id)==slots[id]);
+        REQUIRE(s->getParticle(slots[id]).getId()==id);
+        REQUIRE(s->getParticleById(id).getMass()==masses[id]);
+    }
+    REQUIRE(found==s->getNumOfParticles());
+    REQUIRE(found==500 - 72);
+}
+
+TEST_CASE("Views read the particle store in place", "[views]"){
+    randomSysGenerator g = randomSysGenerator(300);
+    std::unique_ptr<pSystem> s = g.generateInitialConditions();
+    s->deleteParticle(10);
+    nbody_system* c = cHandle(*s);
+    REQUIRE(nbody_abi_version()==NBODY_ABI_VERSION);
+    REQUIRE(nbody_count(c)==299);
+
+    nbody_view positions = nbody_positions(c);
+    nbody_view masses = nbody_masses(c);
+    REQUIRE(positions.count==299);
+    // no copy: the view points at the particles themselves
+    REQUIRE(positions.data==s->getParticle(0).getPosition().data());
+    REQUIRE(positions.stride==sizeof(Particle));
+    REQUIRE(*static_cast<const double*>(masses.data)==s->getParticle(0).getMass());
+
+    // centre of mass with Eigen on the views against the per-particle accessors
+    VectorsView x = asVectors(positions);
+    ScalarsView m = asScalars(masses);
+    Eigen::Vector3d com = x*m/m.sum();
+    Eigen::Vector3d expected(0.0, 0.0, 0.0);
+    double total = 0.0;
+    for(std::size_t i=0; i<299; i++){
+        expected += s->getParticle(i).getMass()*s->getParticle(i).getPosition();
+        total += s->getParticle(i).getMass();
+    }
+    REQUIRE(com.isApprox(expected/total, 1e-12));
+
+    IdsView ids = asIds(nbody_ids(c));
+    REQUIRE(ids(9)==9);
+    REQUIRE(ids(10)==11);
+    REQUIRE(asVectors(nbody_velocities(c)).col(5)==s->getParticle(5).getVelocity());
+
+    pSystem empty;
+    REQUIRE(nbody_positions(cHandle(empty)).count==0);
+}
+
+TEST_CASE("Observers see the state of the steps they are due at", "[observers]"){
+    randomSysGenerator generator1 = randomSysGenerator(64);
+    randomSysGenerator generator2 = randomSysGenerator(64);
+    std::unique_ptr<pSystem> s = generator1.generateInitialConditions();
+    std::unique_ptr<pSystem> reference = generator2.generateInitialConditions();
+    ExecutionPlan serial;
+    serial.parallel = false;
+    s->setExecutionPlan(serial);
+    reference->setExecutionPlan(serial);
+
+    std::vector<long> inlinedSteps;
+    std::vector<double> inlinedTimes;
+    Eigen::Vector3d atStep6;
+    int inlined = s->addObserver("inlined", 3, [&](const StepState& state){
+        REQUIRE(state.count==64);
+        inlinedSteps.push_back(state.step);
+        inlinedTimes.push_back(state.time);
+        if(state.step==6)
+            atStep6 = asVectors(state.positions).col(10);
+    });
+    // the async observer sees a copy, so it must match the reference even after the system has moved on
+    std::vector<Eigen::Vector3d> atStep4;
+    s->addObserver("async", 4, [&](const StepState& state){
+        if(state.step==4){
+            VectorsView positions = asVectors(state.positions);
+            for(Eigen::Index i=0; i<positions.cols(); i++)
+                atStep4.push_back(positions.col(i));
+        }
+        if(state.step==8)
+            throw std::runtime_error("errors in async observers are counted, not thrown");
+    }, ObserverMode::async);
+
+    // half a step past the end, so the float accumulation of evolveSystem gives exactly the steps asked for
+    s->evolveSystem(0.0105, 0.001);
+    s->waitForObservers();
+    REQUIRE(s->getStepCount()==10);
+    REQUIRE(inlinedSteps==std::vector<long>{3, 6, 9});
+    REQUIRE_THAT(inlinedTimes[1], WithinRel(0.006, 1e-12));
+
+    reference->evolveSystem(0.0045, 0.001);
+    REQUIRE(atStep4.size()==64);
+    for(std::size_t i=0; i<64; i++)
+        REQUIRE(atStep4[i]==reference->getParticle(i).getPosition());
+    reference->evolveSystem(0.0025, 0.001);
+    REQUIRE(atStep6==reference->getParticle(10).getPosition());
+
+    std::vector<ObserverStats> stats = s->getObserverStats();
+    REQUIRE(stats.size()==2);
+    REQUIRE(stats[0].calls==3);
+    REQUIRE(stats[1].calls==2);
+    REQUIRE(stats[1].errors==1);
+    REQUIRE(stats[1].mode==ObserverMode::async);
+    REQUIRE(stats[1].observerSeconds>=0.0);
+
+    // steps are counted over runs, and removed observers are not called again
+    s->removeObserver(inlined);
+    s->evolveSystem(0.0055, 0.001);
+    s->waitForObservers();
+    REQUIRE(inlinedSteps.size()==3);
+    REQUIRE(s->getObserverStats()[1].calls==3);
+    REQUIRE_THROWS_AS(s->addObserver("never", 0, [](const StepState&){}), std::invalid_argument);
+}
+
+TEST_CASE("Particles are written in one buffer in every format", "[output]"){
+    pSystem s;
+    s.addParticle(Particle(1.0, Eigen::Vector3d(0.0, 0.5, -2.0), Eigen::Vector3d(1.0, 0.0, 0.25)));
+    s.addParticle(Particle(1.0/3.0, Eigen::Vector3d(1e-9, 2.0, 3.0), Eigen::Vector3d(-1.0, 1e20, 0.0)));
+    s.deleteParticle(0);
+
+    OutputOptions options;
+    options.precision = 3;
+    std::string text;
+    formatRows(s.getState(), 0, 1, options, text);
+    REQUIRE(text=="particle 0\nmass: 0.333\nposition: (1e-09,2,3)\nvelocity: (-1,1e+20,0)\n-------------------\n");
+
+    // at 17 digits the csv rows read back exactly
+    randomSysGenerator g = randomSysGenerator(3000);
+    std::unique_ptr<pSystem> big = g.generateInitialConditions();
+    options.format = OutputFormat::csv;
+    options.precision = 17;
+    std::FILE* file = std::tmpfile();
+    REQUIRE(file!=nullptr);
+    big->writeParticles(fileno(file), options);
+    std::rewind(file);
+    char line[512];
+    REQUIRE(std::fgets(line, sizeof(line), file)!=nullptr);
+    REQUIRE(std::string(line)=="id,mass,x,y,z,vx,vy,vz\n");
+    std::size_t rows = 0;
+    while(std::fgets(line, sizeof(line), file)){
+        unsigned long long id;
+        double m, x, y, z, vx, vy, vz;
+        REQUIRE(std::sscanf(line, "%llu,%lf,%lf,%lf,%lf,%lf,%lf,%lf", &id, &m, &x, &y, &z, &vx, &vy, &vz)==8);
+        const Particle& p = big->getParticle(rows);
+        REQUIRE(id==p.getId());
+        REQUIRE(m==p.getMass());
+        REQUIRE(Eigen::Vector3d(x, y, z)==p.getPosition());
+        REQUIRE(Eigen::Vector3d(vx, vy, vz)==p.getVelocity());
+        rows++;
+    }
+    std::fclose(file);
+    REQUIRE(rows==3000);
+
+    options.format = OutputFormat::tsv;
+    std::string header;
+    formatHeader(options, header);
+    REQUIRE(header=="id\tmass\tx\ty\tz\tvx\tvy\tvz\n");
+    REQUIRE_THROWS_AS(s.writeParticles(-1, options), std::runtime_error);
+}
+
+TEST_CASE("Leapfrog keeps the energy error far below euler", "[integrator]"){
+    solarSysGenerator generator1 = solarSysGenerator();
+    solarSysGenerator generator2 = solarSysGenerator();
+    std::unique_ptr<pSystem> euler = generator1.generateInitialConditions();
+    std::unique_ptr<pSystem> leapfrog = generator2.generateInitialConditions();
+    leapfrog->setIntegrator(Integrator::leapfrog);
+    REQUIRE(leapfrog->getIntegrator()==Integrator::leapfrog);
+
+    auto total = [](const std::tuple<double, double>& E){ return std::get<0>(E) + std::get<1>(E); };
+    const double E0 = total(euler->getEnergy());
+    REQUIRE_THAT(total(leapfrog->getEnergy()), WithinRel(E0, 1e-15));
+    // an orbit of the earth in 2000 steps, cut into runs so the fused drifts are closed in between
+    for(int run=0; run<4; run++){
+        euler->evolveSystem(6.2831/4, 0.0031416);
+        leapfrog->evolveSystem(6.2831/4, 0.0031416);
+    }
+    const double eulerError = std::abs(total(euler->getEnergy()) - E0);
+    const double leapfrogError = std::abs(total(leapfrog->getEnergy()) - E0);
+    REQUIRE(leapfrogError < eulerError/100);
+
+    // the executor path runs the same steps
+    solarSysGenerator generator3 = solarSysGenerator();
+    solarSysGenerator generator4 = solarSysGenerator();
+    std::unique_ptr<pSystem> openmp = generator3.generateInitialConditions();
+    std::unique_ptr<pSystem> pool = generator4.generateInitialConditions();
+    ExecutionPlan serial;
+    serial.parallel = false;
+    openmp->setExecutionPlan(serial);
+    serial.backend = Backend::serial;
+    pool->setExecutionPlan(serial);
+    openmp->setIntegrator(Integrator::leapfrog);
+    pool->setIntegrator(Integrator::leapfrog);
+    openmp->evolveSystem(0.1, 0.001);
+    pool->evolveSystem(0.1, 0.001);
+    for(std::size_t i=0; i<openmp->getNumOfParticles(); i++)
+        REQUIRE(openmp->getParticle(i).getPosition()==pool->getParticle(i).getPosition());
+}
+
+TEST_CASE("Job files give one validated config per run", "[jobs]"){
+    RunConfig defaults;
+    defaults.epsilon = 0.5;
+    std::stringstream job(
+        "# shared by every run\n"
+        "time = 6.2831\n"
+        "timestep = 1e-3   # comment after a value\n"
+        "\n"
+        "[[run]]\n"
+        "name = \"big # not a comment\"\n"
+        "nbody = 1_000\n"
+        "first-touch = true\n"
+        "[[run]]\n"
+        "timestep = 10\n"
+        "seed = 7\n"
+        "integrator = 'leapfrog'\n"
+        "tile-size = 64\n");
+    std::vector<RunConfig> runs = parseJobFile(job, "jobs.toml", defaults);
+    REQUIRE(runs.size()==2);
+    REQUIRE(runs[0].name=="big # not a comment");
+    REQUIRE(runs[0].source=="jobs.toml:5");
+    REQUIRE(runs[0].nbody==1000);
+    REQUIRE(runs[0].firstTouch);
+    REQUIRE(runs[0].timestep==1e-3);
+    REQUIRE(runs[0].epsilon==0.5);
+    REQUIRE(runs[1].name=="run 2");
+    REQUIRE(runs[1].time==6.2831);
+    REQUIRE(runs[1].integrator=="leapfrog");
+    REQUIRE(runs[0].seed==1);
+    REQUIRE(runs[1].seed==7);
+    REQUIRE(runs[1].tileSize==64);
+    REQUIRE(validateRun(runs[0]).empty());
+    // a step longer than the run is caught before anything runs
+    std::vector<std::string> problems = validateJobs(runs);
+    REQUIRE(problems.size()==1);
+    REQUIRE(problems[0]=="jobs.toml:9: run 2: timestep is longer than the whole run");
+
+    auto parse = [&](const std::string& text){
+        std::stringstream in(text);
+        return parseJobFile(in, "bad.toml", defaults);
+    };
+    REQUIRE_THROWS_WITH(parse("time = 1\ntimestep = \"fast\"\n"), "bad.toml:2: 'timestep' must be a number, not a string");
+    REQUIRE_THROWS_WITH(parse("steps = 10\n"), "bad.toml:1: unknown key 'steps'");
+    REQUIRE_THROWS_WITH(parse("[run]\n"), "bad.toml:1: only [[run]] tables are supported, not [run]");
+    REQUIRE_THROWS_WITH(parse("time = 1\ntime = 2\n"), "bad.toml:2: 'time' is set twice");
+    REQUIRE_THROWS_WITH(parse("name = \"open\n"), "bad.toml:1: unterminated string");
+    REQUIRE_THROWS_AS(parse("nbody = 1.5\n"), JobError);
+
+    // a run writing the checkpoint the next one starts from, and two runs writing the same trace
+    RunConfig first = runs[0];
+    first.checkpointEvery = 10;
+    first.checkpoint = "/tmp/nbody-jobs-test-checkpoint.csv";
+    first.trace = "/tmp/nbody-jobs-test-trace.json";
+    RunConfig second = runs[0];
+    second.name = "restart";
+    second.nbody = 0;
+    second.initial = first.checkpoint;
+    second.trace = first.trace;
+    second.pin = "everywhere";
+    problems = validateJobs({first, second});
+    REQUIRE(problems.size()==2);
+    REQUIRE(problems[0]=="jobs.toml:5: restart: pin must be none, compact or scatter, not everywhere");
+    REQUIRE(problems[1]=="jobs.toml:5: restart writes /tmp/nbody-jobs-test-trace.json, which big # not a comment writes too");
+    REQUIRE(validateRun(second).size()==2);
+}
+
+TEST_CASE("Particle files written as CSV read back as the same system", "[jobs]"){
+    randomSysGenerator g = randomSysGenerator(100);
+    std::unique_ptr<pSystem> s = g.generateInitialConditions();
+    const std::string filename = "/tmp/nbody-particles-test.csv";
+    OutputOptions exact;
+    exact.format = OutputFormat::csv;
+    exact.precision = 17;
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    REQUIRE(fd>=0);
+    s->writeParticles(fd, exact);
+    ::close(fd);
+
+    std::unique_ptr<pSystem> copy = fileSysGenerator(filename).generateInitialConditions();
+    REQUIRE(copy->getNumOfParticles()==100);
+    for(std::size_t i=0; i<100; i++){
+        REQUIRE(copy->getParticle(i).getMass()==s->getParticle(i).getMass());
+        REQUIRE(copy->getParticle(i).getPosition()==s->getParticle(i).getPosition());
+        REQUIRE(copy->getParticle(i).getVelocity()==s->getParticle(i).getVelocity());
+    }
+
+    // a checkpoint keeps the ids, with the gaps of deleted bodies, and the step and time it was taken at
+    s->deleteParticleById(3);
+    s->deleteParticleById(50);
+    s->evolveSystem(0.0105, 0.001);
+    fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    REQUIRE(fd>=0);
+    const std::string clock = "# step 10 time 0.01\n";
+    REQUIRE(::write(fd, clock.data(), clock.size())==static_cast<ssize_t>(clock.size()));
+    s->writeParticles(fd, exact);
+    ::close(fd);
+    std::unique_ptr<pSystem> restarted = fileSysGenerator(filename).generateInitialConditions();
+    REQUIRE(restarted->getNumOfParticles()==98);
+    REQUIRE(restarted->getStepCount()==10);
+    REQUIRE(restarted->getTime()==0.01);
+    REQUIRE(restarted->getParticle(3).getId()==4);
+    REQUIRE(restarted->getParticleById(42).getPosition()==s->getParticleById(42).getPosition());
+    REQUIRE_THROWS_AS(restarted->indexOf(50), std::out_of_range);
+    restarted->addParticle(Particle(1.0, Eigen::Vector3d(0,0,0), Eigen::Vector3d(0,0,0)));
+    REQUIRE(restarted->getParticle(98).getId()==100);
+
+    // ids must be unique and new to the system
+    std::uint64_t ids[2] = {5, 5};
+    double masses[2] = {1.0, 1.0};
+    double zeros[6] = {};
+    REQUIRE_THROWS_AS(restarted->addParticles(2, ids, masses, zeros, zeros), std::invalid_argument);
+    ids[0] = 200;
+    ids[1] = 3;
+    REQUIRE_THROWS_AS(restarted->addParticles(2, ids, masses, zeros, zeros), std::invalid_argument);
+    REQUIRE(restarted->getNumOfParticles()==99);
+
+    std::remove(filename.c_str());
+    REQUIRE_THROWS_AS(fileSysGenerator(filename), std::invalid_argument);
+}
+
+TEST_CASE("Ensembles run independent systems to the same results as one at a time", "[ensemble]"){
+    // seeds give different systems, the same seed the same one
+    REQUIRE(randomSysGenerator(10, 7).generateInitialConditions()->getParticle(3).getPosition()==
+            randomSysGenerator(10, 7).generateInitialConditions()->getParticle(3).getPosition());
+    REQUIRE(randomSysGenerator(10, 7).generateInitialConditions()->getParticle(3).getPosition()!=
+            randomSysGenerator(10, 8).generateInitialConditions()->getParticle(3).getPosition());
+    REQUIRE(solarSysGenerator(2).generateInitialConditions()->getParticle(3).getPosition()!=
+            solarSysGenerator(3).generateInitialConditions()->getParticle(3).getPosition());
+
+    Ensemble ensemble(3);
+    for(unsigned seed=1; seed<=5; seed++){
+        ensemble.add(Ensemble::Member{"seed " + std::to_string(seed), [seed]{
+            return randomSysGenerator(20 + 10*seed, seed).generateInitialConditions();
+        }, 0.0205, 0.001, 0.0});
+    }
+    ensemble.add(Ensemble::Member{"bad epsilon", []{ return solarSysGenerator().generateInitialConditions(); }, 0.01, 0.001, -1.0});
+    std::vector<Ensemble::Result> results = ensemble.run();
+    REQUIRE(results.size()==6);
+    REQUIRE(results[5].error=="Parameter epsilon must be larger than or equal to zero.");
+
+    for(unsigned seed=1; seed<=5; seed++){
+        const Ensemble::Result& result = results[seed - 1];
+        REQUIRE(result.name=="seed " + std::to_string(seed));
+        REQUIRE(result.error.empty());
+        REQUIRE(result.bodies==20 + 10*seed);
+        REQUIRE(result.steps==20);
+
+        std::unique_ptr<pSystem> alone = randomSysGenerator(20 + 10*seed, seed).generateInitialConditions();
+        ExecutionPlan serial;
+        serial.parallel = false;
+        serial.backend = Backend::serial;
+        alone->setExecutionPlan(serial);
+        std::tuple<double, double> before = alone->getEnergy();
+        alone->evolveSystem(0.0205, 0.001);
+        std::tuple<double, double> after = alone->getEnergy();
+        double E0 = std::get<0>(before) + std::get<1>(before);
+        double E1 = std::get<0>(after) + std::get<1>(after);
+        REQUIRE(result.energyChange==(E0 - E1)/E0*100);
+    }
+
+    const Ensemble::Stats& stats = ensemble.stats();
+    REQUIRE(stats.workers==3);
+    REQUIRE(stats.systemSteps==100);
+    REQUIRE(stats.systemStepsPerSecond>0);
+    REQUIRE_THROWS_AS(ensemble.add(Ensemble::Member{"empty", nullptr, 1.0, 0.1, 0.0}), std::invalid_argument);
+}
+
+TEST_CASE("Batched systems follow the same orbits as single systems", "[batch]"){
+    using Catch::Matchers::WithinAbs;
+    using Catch::Matchers::WithinRel;
+    for(Integrator integrator : {Integrator::euler, Integrator::leapfrog}){
+        // 11 systems fill one group and part of a second one
+        SystemBatch batch(9);
+        batch.setIntegrator(integrator);
+        std::vector<std::unique_ptr<pSystem>> alone;
+        for(unsigned seed=1; seed<=11; seed++){
+            std::unique_ptr<pSystem> s1 = solarSysGenerator(seed).generateInitialConditions();
+            REQUIRE(batch.add(*s1)==seed - 1);
+            s1->setIntegrator(integrator);
+            alone.push_back(std::move(s1));
+        }
+        REQUIRE(batch.size()==11);
+        batch.evolve(0.1005, 0.001, 0.01);
+        REQUIRE(batch.getStepCount()==100);
+
+        std::vector<std::tuple<double, double>> energies = batch.getEnergies();
+        REQUIRE(energies.size()==11);
+        for(std::size_t k=0; k<alone.size(); k++){
+            alone[k]->evolveSystem(0.1005, 0.001, 0.01);
+            for(std::size_t i=0; i<9; i++){
+                REQUIRE(batch.getMass(k, i)==alone[k]->getParticle(i).getMass());
+                for(int d=0; d<3; d++){
+                    REQUIRE_THAT(batch.getPosition(k, i)(d), WithinAbs(alone[k]->getParticle(i).getPosition()(d), 1e-12));
+                    REQUIRE_THAT(batch.getVelocity(k, i)(d), WithinAbs(alone[k]->getParticle(i).getVelocity()(d), 1e-12));
+                }
+            }
+            std::tuple<double, double> energy = alone[k]->getEnergy();
+            REQUIRE_THAT(std::get<0>(energies[k]), WithinRel(std::get<0>(energy), 1e-12));
+            REQUIRE_THAT(std::get<1>(energies[k]), WithinRel(std::get<1>(energy), 1e-12));
+            REQUIRE(batch.extract(k)->getParticle(4).getPosition()==batch.getPosition(k, 4));
+        }
+    }
+
+    SystemBatch batch(9);
+    REQUIRE_THROWS_AS(batch.add(*randomSysGenerator(10).generateInitialConditions()), std::invalid_argument);
+    REQUIRE_THROWS_AS(batch.getPosition(0, 0), std::out_of_range);
+    REQUIRE_THROWS_AS(SystemBatch(0), std::invalid_argument);
+
+    // an ensemble batches the members that match, and runs the others alone
+    Ensemble ensemble(2);
+    ensemble.setBatching(true);
+    for(unsigned seed=1; seed<=10; seed++){
+        ensemble.add(Ensemble::Member{"seed " + std::to_string(seed), [seed]{
+            return solarSysGenerator(seed).generateInitialConditions();
+        }, 0.0205, 0.001, 0.0});
+    }
+    ensemble.add(Ensemble::Member{"random", []{ return randomSysGenerator(20).generateInitialConditions(); }, 0.0205, 0.001, 0.0});
+    std::vector<Ensemble::Result> results = ensemble.run();
+    REQUIRE(results.size()==11);
+    for(unsigned seed=1; seed<=10; seed++){
+        std::unique_ptr<pSystem> s1 = solarSysGenerator(seed).generateInitialConditions();
+        std::tuple<double, double> before = s1->getEnergy();
+        s1->evolveSystem(0.0205, 0.001);
+        std::tuple<double, double> after = s1->getEnergy();
+        double E0 = std::get<0>(before) + std::get<1>(before);
+        double E1 = std::get<0>(after) + std::get<1>(after);
+        REQUIRE(results[seed - 1].error.empty());
+        REQUIRE(results[seed - 1].steps==20);
+        REQUIRE_THAT(results[seed - 1].energyChange, WithinAbs((E0 - E1)/E0*100, 1e-9));
+    }
+    REQUIRE(results[10].error.empty());
+    REQUIRE(results[10].bodies==20);
+    REQUIRE(ensemble.stats().systemSteps==220);
+}
+
+TEST_CASE("Fixed-size engines follow the same orbits as the generic loops", "[fixed]"){
+    using Catch::Matchers::WithinAbs;
+    for(Integrator integrator : {Integrator::euler, Integrator::leapfrog}){
+        for(std::size_t n : {2, 9, 16}){
+            std::unique_ptr<pSystem> generic = randomSysGenerator(n, 3).generateInitialConditions();
+            std::unique_ptr<pSystem> fixed = randomSysGenerator(n, 3).generateInitialConditions();
+            ExecutionPlan serial;
+            serial.parallel = false;
+            generic->setExecutionPlan(serial);
+            serial.fixedSize = true;
+            fixed->setExecutionPlan(serial);
+            generic->setIntegrator(integrator);
+            fixed->setIntegrator(integrator);
+            generic->evolveSystem(0.1005, 0.001, 0.01);
+            fixed->evolveSystem(0.1005, 0.001, 0.01);
+            REQUIRE(fixed->getStepCount()==100);
+            for(std::size_t i=0; i<n; i++){
+                for(int d=0; d<3; d++){
+                    REQUIRE_THAT(fixed->getParticle(i).getPosition()(d), WithinAbs(generic->getParticle(i).getPosition()(d), 1e-12));
+                    REQUIRE_THAT(fixed->getParticle(i).getVelocity()(d), WithinAbs(generic->getParticle(i).getVelocity()(d), 1e-12));
+                }
+            }
+        }
+    }
+
+    // sizes without an engine are left alone
+    std::vector<double> masses(maxFixedBodies + 1, 1.0);
+    std::vector<double> positions(3*masses.size(), 0.0);
+    std::vector<double> velocities(3*masses.size(), 0.0);
+    positions[3] = 1.0;
+    REQUIRE(!evolveFixed(masses.size(), masses.data(), positions.data(), velocities.data(), 10, 0.01, ForceLaw::plummer, 0.0, 0.0, Integrator::euler));
+    REQUIRE(velocities[0]==0.0);
+    REQUIRE(evolveFixed(2, masses.data(), positions.data(), velocities.data(), 1, 0.01, ForceLaw::plummer, 0.0, 0.0, Integrator::euler));
+    REQUIRE(velocities[0]==0.01);
+    REQUIRE(velocities[3]==-0.01);
+}
+
+TEST_CASE("Force laws soften or cut the pair force and every engine follows them", "[forcelaw]"){
+    using Catch::Matchers::WithinAbs;
+    using Catch::Matchers::WithinRel;
+    pSystem s1;
+    Particle here(1.0, Eigen::Vector3d(0,0,0), Eigen::Vector3d(0,0,0));
+    Particle near(2.0, Eigen::Vector3d(0.3,0,0), Eigen::Vector3d(0,0,0));
+    Particle far(2.0, Eigen::Vector3d(3.0,0,0), Eigen::Vector3d(0,0,0));
+
+    // plummer is newtonian without softening
+    REQUIRE_THAT(s1.calcAcceleration(here, far, 0.0)(0), WithinRel(2.0/9.0, 1e-15));
+    REQUIRE_THAT(s1.calcAcceleration(here, near, 1.0)(0), WithinRel(2.0*0.3/std::pow(1.09, 1.5), 1e-15));
+
+    // the spline is newtonian beyond epsilon, finite below it and continuous at it
+    s1.setForceLaw(ForceLaw::spline);
+    REQUIRE(s1.getForceLaw()==ForceLaw::spline);
+    REQUIRE_THAT(s1.calcAcceleration(here, far, 1.0)(0), WithinRel(2.0/9.0, 1e-15));
+    REQUIRE_THAT(s1.calcAcceleration(here, near, 1.0)(0), WithinRel(2.0*0.3*(32.0/3.0 + 0.09*(32.0*0.3 - 38.4)), 1e-13));
+    SplineLaw spline{1.0, 1.0};
+    REQUIRE_THAT(spline.scale(0.999999*0.999999), WithinRel(1.0, 1e-5));
+    REQUIRE_THAT(spline.scale(0.499999*0.499999), WithinRel(spline.scale(0.500001*0.500001), 1e-5));
+
+    // truncated is plummer inside the cutoff and zero beyond it
+    REQUIRE_THROWS_AS(s1.setForceLaw(ForceLaw::truncated), std::invalid_argument);
+    s1.setForceLaw(ForceLaw::truncated, 2.0);
+    REQUIRE(s1.getCutoff()==2.0);
+    REQUIRE_THAT(s1.calcAcceleration(here, near, 0.0)(0), WithinRel(2.0/0.09, 1e-15));
+    REQUIRE(s1.calcAcceleration(here, far, 0.0)(0)==0.0);
+
+    // the generic loops, the fixed-size engine and batches step the same orbits with every law
+    for(ForceLaw law : {ForceLaw::plummer, ForceLaw::spline, ForceLaw::truncated}){
+        std::unique_ptr<pSystem> generic = randomSysGenerator(9, 5).generateInitialConditions();
+        std::unique_ptr<pSystem> fixed = randomSysGenerator(9, 5).generateInitialConditions();
+        std::unique_ptr<pSystem> batched = randomSysGenerator(9, 5).generateInitialConditions();
+        ExecutionPlan serial;
+        serial.parallel = false;
+        generic->setExecutionPlan(serial);
+        serial.fixedSize = true;
+        fixed->setExecutionPlan(serial);
+        generic->setForceLaw(law, 1.5);
+        fixed->setForceLaw(law, 1.5);
+        SystemBatch batch(9);
+        batch.setForceLaw(law, 1.5);
+        batch.add(*batched);
+
+        generic->evolveSystem(0.1005, 0.001, 0.5);
+        fixed->evolveSystem(0.1005, 0.001, 0.5);
+        batch.evolve(0.1005, 0.001, 0.5);
+        for(std::size_t i=0; i<9; i++){
+            for(int d=0; d<3; d++){
+                double expected = generic->getParticle(i).getVelocity()(d);
+                REQUIRE_THAT(fixed->getParticle(i).getVelocity()(d), WithinAbs(expected, 1e-12));
+                REQUIRE_THAT(batch.getVelocity(0, i)(d), WithinAbs(expected, 1e-12));
+            }
+        }
+    }
+}
+
+TEST_CASE("Every instruction set level steps the same bits", "[isa]"){
+    const VectorIsa detected = detectVectorIsa();
+    std::vector<std::vector<double>> runs;
+    for(VectorIsa isa : {VectorIsa::sse2, VectorIsa::sse42, VectorIsa::avx2, VectorIsa::avx512}){
+        if(isa > detected){
+            REQUIRE_THROWS_AS(setVectorIsa(isa), std::invalid_argument);
+            continue;
+        }
+        setVectorIsa(isa);
+        REQUIRE(activeVectorIsa()==isa);
+        std::vector<double> state;
+        for(Integrator integrator : {Integrator::euler, Integrator::leapfrog}){
+            SystemBatch batch(9);
+            batch.setIntegrator(integrator);
+            batch.setForceLaw(ForceLaw::spline);
+            for(unsigned seed=1; seed<=3; seed++){
+                batch.add(*solarSysGenerator(seed).generateInitialConditions());
+            }
+            batch.evolve(0.0505, 0.001, 0.01);
+            for(std::size_t k=0; k<batch.size(); k++){
+                for(std::size_t i=0; i<9; i++){
+                    for(int d=0; d<3; d++){
+                        state.push_back(batch.getPosition(k, i)(d));
+                        state.push_back(batch.getVelocity(k, i)(d));
+                    }
+                }
+                state.push_back(std::get<0>(batch.getEnergies()[k]));
+                state.push_back(std::get<1>(batch.getEnergies()[k]));
+            }
+
+            std::unique_ptr<pSystem> fixed = randomSysGenerator(13, 4).generateInitialConditions();
+            ExecutionPlan serial;
+            serial.parallel = false;
+            serial.fixedSize = true;
+            fixed->setExecutionPlan(serial);
+            REQUIRE(fixed->usesFixedSize());
+            fixed->setIntegrator(integrator);
+            fixed->evolveSystem(0.0505, 0.001, 0.01);
+            for(std::size_t i=0; i<13; i++){
+                for(int d=0; d<3; d++){
+                    state.push_back(fixed->getParticle(i).getPosition()(d));
+                    state.push_back(fixed->getParticle(i).getVelocity()(d));
+                }
+            }
+
+            // the generic loops: serial rows with an unsoftened law, parallel rows, and parallel blocks in
+            // tiles that do not line up with the lanes of the row kernels
+            ExecutionPlan parallel;
+            parallel.threads = 2;
+            ExecutionPlan blocks = parallel;
+            blocks.decomposition = ForceDecomposition::blocks;
+            blocks.tileSize = 13;
+            for(const ExecutionPlan& plan : {serial, parallel, blocks}){
+                std::unique_ptr<pSystem> generic = randomSysGenerator(maxFixedBodies + 21, 5).generateInitialConditions();
+                generic->setExecutionPlan(plan);
+                REQUIRE(!generic->usesFixedSize());
+                generic->setIntegrator(integrator);
+                generic->setForceLaw(plan.parallel ? ForceLaw::spline : ForceLaw::plummer);
+                generic->evolveSystem(0.0505, 0.001, plan.parallel ? 0.01 : 0.0);
+                for(std::size_t i=0; i<generic->getNumOfParticles(); i++){
+                    for(int d=0; d<3; d++){
+                        state.push_back(generic->getParticle(i).getPosition()(d));
+                        state.push_back(generic->getParticle(i).getVelocity()(d));
+                    }
+                }
+                state.push_back(std::get<0>(generic->getEnergy()));
+                state.push_back(std::get<1>(generic->getEnergy()));
+            }
+        }
+        runs.push_back(state);
+    }
+    setVectorIsa(detected);
+    REQUIRE(!runs.empty());
+    for(const std::vector<double>& state : runs){
+        REQUIRE(state==runs[0]);
+    }
+}